@@ -1,2 +1,4 @@
 from .dumpulator import Dumpulator, ExceptionType, MemoryViolation, ExceptionInfo
 from .ntsyscalls import syscall
+from .hle import hle
+from .pool import DumpulatorPool
@@ -1,6 +1,7 @@
+import ctypes
 import struct
 from collections import namedtuple
-from typing import List, Dict, Optional, Iterable
+from typing import List, Dict, Optional, Iterable, Tuple
 
 from unicorn import *
 from unicorn.x86_const import *
@@ -28,10 +29,70 @@ def map_unicorn_perms(protect: MemoryProtect):
     return perms
 
 
+class NativeBatch:
+    """
+    uc_reg_read_batch/uc_reg_write_batch called through ctypes, for bindings that do not wrap them (unicorn 2.0.x).
+    The buffers are allocated once per list of register ids, so transferring the same registers again is one call.
+    """
+    def __init__(self, lib, handle):
+        self._handle = handle
+        self._read = lib.uc_reg_read_batch
+        self._write = lib.uc_reg_write_batch
+        for func in (self._read, self._write):
+            func.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_void_p), ctypes.c_int]
+            func.restype = ctypes.c_int
+        self._buffers: Dict[Tuple[int, ...], tuple] = {}
+
+    @staticmethod
+    def create(uc) -> Optional["NativeBatch"]:
+        handle = getattr(uc, "_uch", None)
+        if handle is None:
+            return None
+        try:
+            import unicorn.unicorn
+            return NativeBatch(unicorn.unicorn._uc, handle)
+        except (ImportError, AttributeError):
+            return None
+
+    def _get_buffers(self, reg_ids: Tuple[int, ...]):
+        buffers = self._buffers.get(reg_ids, None)
+        if buffers is None:
+            count = len(reg_ids)
+            # Two 64-bit words per register, so passing a 128-bit register cannot overflow into the next slot
+            values = (ctypes.c_uint64 * (count * 2))()
+            base = ctypes.addressof(values)
+            pointers = (ctypes.c_void_p * count)(*[base + i * 16 for i in range(count)])
+            buffers = (ctypes.c_int * count)(*reg_ids), values, pointers, count
+            self._buffers[reg_ids] = buffers
+        return buffers
+
+    def read(self, reg_ids: List[int]) -> List[int]:
+        ids, values, pointers, count = self._get_buffers(tuple(reg_ids))
+        status = self._read(self._handle, ids, pointers, count)
+        if status != UC_ERR_OK:
+            raise UcError(status)
+        return values[::2]
+
+    def write(self, values: List[Tuple[int, int]]):
+        ids, buffer, pointers, count = self._get_buffers(tuple(reg for reg, _ in values))
+        buffer[::2] = [value for _, value in values]
+        status = self._write(self._handle, ids, pointers, count)
+        if status != UC_ERR_OK:
+            raise UcError(status)
+
+
 class Registers:
     def __init__(self, uc: Uc, x64):
         self._uc = uc
         self._x64 = x64
+        # Only wrapped by the unicorn bindings since 2.1, older ones go through the library directly
+        self._reg_read_batch = getattr(uc, "reg_read_batch", None)
+        self._reg_write_batch = getattr(uc, "reg_write_batch", None)
+        if self._reg_read_batch is None or self._reg_write_batch is None:
+            native = NativeBatch.create(uc)
+            if native is not None:
+                self._reg_read_batch = native.read
+                self._reg_write_batch = native.write
         self._regmap = {
             "ah": UC_X86_REG_AH,
             "al": UC_X86_REG_AL,
@@ -372,6 +433,26 @@ class Registers:
         else:
             self._uc.reg_write(self._resolve_reg(name), value)
 
+    def read_batch(self, reg_ids: List[int]) -> List[int]:
+        """
+        Read multiple (up to 64-bit) registers by unicorn id, with a single call into unicorn when supported.
+        """
+        if self._reg_read_batch is not None:
+            return self._reg_read_batch(reg_ids)
+        reg_read = self._uc.reg_read
+        return [reg_read(reg) for reg in reg_ids]
+
+    def write_batch(self, values: List[Tuple[int, int]]):
+        """
+        Write multiple (up to 64-bit) registers, values are (unicorn id, value) pairs.
+        """
+        if self._reg_write_batch is not None:
+            self._reg_write_batch(values)
+        else:
+            reg_write = self._uc.reg_write
+            for reg, value in values:
+                reg_write(reg, value)
+
     # value = dp.regs[myname]
     def __getitem__(self, name: str):
         return self.__getattr__(name)
@@ -0,0 +1,176 @@
+import json
+import os
+import struct
+from dataclasses import dataclass, field
+from typing import Any, Dict, List, NamedTuple, Optional, Tuple
+
+import minidump.minidumpfile as minidump
+from .modules import ModuleTable
+
+# Bump when the PreparedDump format changes
+CACHE_VERSION = 2
+# magic, version, size and modification time (ns) of the dump
+CACHE_HEADER = struct.Struct("<8sIQQ")
+CACHE_MAGIC = b"DPCACHE\0"
+
+class PreparedThread(NamedTuple):
+    # Same attribute names as minidump.MinidumpThread
+    ThreadId: int
+    Teb: int
+    ContextObject: Any
+    # Location of the context in the dump, the cache stores this instead of the parsed context
+    ContextRva: int
+
+class PreparedRegion(NamedTuple):
+    base: int
+    size: int
+    protect: int
+    type: int
+    # (address, size, protect), protect is None when it is the same as the region
+    commits: List[Tuple[int, int, Optional[int]]]
+
+@dataclass
+class PreparedDump:
+    """
+    Everything the Dumpulator constructor needs from a minidump, so it can be stored in a .dpcache sidecar file
+    (see Dumpulator.prepare) instead of parsing the streams of the dump every time. The memory contents are not
+    stored, the pages are read from the dump with the segment index.
+
+    The cache is plain JSON (no code is executed when loading it) after a binary header that ties it to the size and
+    modification time of the dump. The thread contexts are parsed from the dump itself.
+    """
+    filename: str
+    x64: bool
+    process_id: int
+    exception_thread_id: Optional[int]
+    threads: List[PreparedThread]
+    regions: List[PreparedRegion]
+    # (virtual address, size, file offset)
+    segments: List[Tuple[int, int, int]]
+    # (handle, type name, object name)
+    handles: List[Tuple[int, Optional[str], Optional[str]]]
+    # [base, size, path, (TimeDateStamp, SizeOfImage), table], the table is filled by Dumpulator._setup_modules
+    modules: List[list] = field(default_factory=list)
+    # Syscall names by index, filled by Dumpulator._setup_syscalls
+    nt_syscalls: Optional[List[str]] = None
+    win32k_syscalls: Optional[List[str]] = None
+
+    @property
+    def complete(self):
+        return self.nt_syscalls is not None and all(entry[4] is not None for entry in self.modules)
+
+    @staticmethod
+    def from_minidump(dump: minidump.MinidumpFile) -> "PreparedDump":
+        exception_thread_id = None
+        if dump.exception is not None:
+            exception_thread_id = dump.exception.exception_records[0].ThreadId
+        threads = [PreparedThread(thread.ThreadId, thread.Teb, thread.ContextObject, thread.ThreadContext.Rva) for thread in dump.threads.threads]
+        x64 = type(threads[0].ContextObject) is not minidump.WOW64_CONTEXT
+        mask = 0xFFFFFFFFFFFFFFFF if x64 else 0xFFFFFFFF
+
+        # Group the memory information by allocation
+        groups: List[List[minidump.MinidumpMemoryInfo]] = []
+        for info in dump.memory_info.infos:
+            info.AllocationBase &= mask
+            info.BaseAddress &= mask
+            if len(groups) == 0 or info.AllocationBase != groups[-1][0].AllocationBase or info.State == minidump.MemoryState.MEM_FREE:
+                groups.append([])
+            groups[-1].append(info)
+        regions = []
+        for group in groups:
+            info = group[0]
+            if info.State == minidump.MemoryState.MEM_FREE:
+                continue
+            commits = []
+            for info in group:
+                if info.State == minidump.MemoryState.MEM_COMMIT:
+                    protect = None if info.Protect is None else info.Protect.value
+                    commits.append((info.BaseAddress & mask, info.RegionSize, protect))
+            info = group[0]
+            size = sum(info.RegionSize for info in group)
+            regions.append(PreparedRegion(info.BaseAddress, size, info.AllocationProtect, info.Type.value, commits))
+
+        segments = [(seg.start_virtual_address & mask, seg.size, seg.start_file_address) for seg in dump.memory_segments_64.memory_segments]
+        handles = []
+        if dump.handles is not None:
+            handles = [(handle.Handle, handle.TypeName, handle.ObjectName) for handle in dump.handles.handles]
+        modules = [[module.baseaddress, module.size, module.name, None, None] for module in dump.modules.modules]
+        return PreparedDump(dump.filename, x64, dump.misc_info.ProcessId, exception_thread_id, threads, regions, segments, handles, modules)
+
+    def _to_json(self) -> Dict[str, Any]:
+        return {
+            "x64": self.x64,
+            "process_id": self.process_id,
+            "exception_thread_id": self.exception_thread_id,
+            "threads": [(thread.ThreadId, thread.Teb, thread.ContextRva) for thread in self.threads],
+            "regions": [tuple(region) for region in self.regions],
+            "segments": self.segments,
+            "handles": self.handles,
+            "modules": [(base, size, path, key, None if table is None else table.to_json()) for base, size, path, key, table in self.modules],
+            "nt_syscalls": self.nt_syscalls,
+            "win32k_syscalls": self.win32k_syscalls,
+        }
+
+    @staticmethod
+    def _from_json(data: Dict[str, Any], filename: str, dump_file) -> "PreparedDump":
+        x64 = bool(data["x64"])
+        context_type = minidump.CONTEXT if x64 else minidump.WOW64_CONTEXT
+        threads = []
+        for thread_id, teb, context_rva in data["threads"]:
+            dump_file.seek(context_rva)
+            threads.append(PreparedThread(thread_id, teb, context_type.parse(dump_file), context_rva))
+        regions = []
+        for base, size, protect, type, commits in data["regions"]:
+            regions.append(PreparedRegion(base, size, protect, type, [(addr, size, protect) for addr, size, protect in commits]))
+        modules = []
+        for base, size, path, key, table in data["modules"]:
+            key = None if key is None else (key[0], key[1])
+            table = None if table is None else ModuleTable.from_json(table)
+            modules.append([base, size, path, key, table])
+        return PreparedDump(
+            filename,
+            x64,
+            data["process_id"],
+            data["exception_thread_id"],
+            threads,
+            regions,
+            [(virtual_address, size, file_offset) for virtual_address, size, file_offset in data["segments"]],
+            [(handle, type_name, object_name) for handle, type_name, object_name in data["handles"]],
+            modules,
+            data["nt_syscalls"],
+            data["win32k_syscalls"],
+        )
+
+    def save(self, path: str):
+        stat = os.stat(self.filename)
+        header = CACHE_HEADER.pack(CACHE_MAGIC, CACHE_VERSION, stat.st_size, stat.st_mtime_ns)
+        # Write to a temporary file first, other processes might be loading the cache
+        temp_path = f"{path}.{os.getpid()}.tmp"
+        with open(temp_path, "wb") as f:
+            f.write(header)
+            f.write(json.dumps(self._to_json(), separators=(",", ":")).encode())
+        os.replace(temp_path, path)
+
+    @staticmethod
+    def load(path: str, filename: str) -> Optional["PreparedDump"]:
+        """
+        Load the cache of the dump filename, returns None when there is no (valid) cache.
+        """
+        try:
+            with open(path, "rb") as f:
+                data = f.read()
+            stat = os.stat(filename)
+            if len(data) < CACHE_HEADER.size:
+                return None
+            magic, version, size, mtime_ns = CACHE_HEADER.unpack_from(data)
+            if magic != CACHE_MAGIC or version != CACHE_VERSION or size != stat.st_size or mtime_ns != stat.st_mtime_ns:
+                return None
+            # The dump might have been moved together with the cache, so the filename is not stored
+            with open(filename, "rb") as dump_file:
+                return PreparedDump._from_json(json.loads(data[CACHE_HEADER.size:]), filename, dump_file)
+        except Exception:
+            # Whatever is wrong with the file, it is a cache miss
+            return None
+
+def cache_path(filename: str) -> str:
+    return filename + ".dpcache"
@@ -1,12 +1,16 @@
 import ctypes
+import mmap
 import struct
 import sys
+import threading
+import time
 import traceback
 from enum import Enum
-from typing import List, Union, NamedTuple, Callable
+from typing import List, Set, Tuple, Union, NamedTuple, Callable, FrozenSet
 import inspect
 from collections import OrderedDict
-from dataclasses import dataclass, field
+from contextlib import contextmanager
+from dataclasses import dataclass, field, replace
 
 import minidump.minidumpfile as minidump
 from unicorn import *
@@ -18,14 +22,26 @@ from .native import *
 from .details import *
 from .memory import *
 from .modules import *
+from .tracing import BinaryTraceWriter, BlockTraceWriter
+from .exportcache import ExportCache, parse_images
+from .dpcache import PreparedDump, cache_path
+from .dumpwriter import write_minidump
+from .scheduler import Scheduler
+from .profiler import Profiler
 from capstone import *
 from capstone.x86 import *
 
 syscall_functions = {}
+# Argument marshallers of the syscall implementations, compiled once per function
+syscall_marshallers = {}
+# High-level implementations of exports, indexed by (module, export)
+hle_functions = {}
 
 PAGE_SIZE = 0x1000
 USER_CAVE = 0x5000
 FORCE_KILL_ADDR = USER_CAVE - 0x20
+# Return address of the threads created by the guest
+THREAD_EXIT_ADDR = USER_CAVE + 0x20
 TSS_BASE = 0xfffff8076d963000
 KERNEL_CAVE = TSS_BASE - 0x2000
 IRETQ_OFFSET = 0x100
@@ -100,23 +116,114 @@ class UnicornPageManager(PageManager):
             data = bytes(data)
         self._uc.mem_write(addr, data)
 
+class SegmentPrefetcher:
+    """
+    Reads the memory segments of a minidump on a background thread. With keep=True the data is stored and served
+    through slicing (like the mmap backing), reads of ranges that were not fetched yet are done synchronously.
+    Otherwise the contents are discarded and the thread only warms up the page cache for the mmap backing.
+    """
+    CHUNK_SIZE = 0x100000
+
+    def __init__(self, file, ranges: List[Tuple[int, int]], keep: bool):
+        self._file = file
+        self._ranges = sorted(ranges)
+        self._keep = keep
+        self._chunks: Dict[int, bytes] = {}
+        # Protects the file position and the chunks
+        self._lock = threading.Lock()
+        self._stop = False
+        self._thread: Optional[threading.Thread] = None
+
+    def _read_chunk(self, chunk: int) -> bytes:
+        data = self._chunks.get(chunk, None)
+        if data is None:
+            self._file.seek(chunk)
+            data = self._file.read(self.CHUNK_SIZE)
+            self._chunks[chunk] = data
+        return data
+
+    def __getitem__(self, key: slice) -> bytes:
+        assert self._keep
+        parts = []
+        offset = key.start
+        with self._lock:
+            while offset < key.stop:
+                chunk = offset - offset % self.CHUNK_SIZE
+                data = self._read_chunk(chunk)
+                end = min(key.stop, chunk + len(data))
+                if end <= offset:
+                    break
+                parts.append(data[offset - chunk:end - chunk])
+                offset = end
+        return b"".join(parts)
+
+    def _run(self):
+        scratch = bytearray(self.CHUNK_SIZE)
+        for offset, size in self._ranges:
+            for chunk in range(offset - offset % self.CHUNK_SIZE, offset + size, self.CHUNK_SIZE):
+                if self._stop:
+                    return
+                if self._keep:
+                    with self._lock:
+                        self._read_chunk(chunk)
+                else:
+                    self._file.seek(chunk)
+                    self._file.readinto(scratch)
+
+    @property
+    def done(self) -> bool:
+        return self._thread is not None and not self._thread.is_alive()
+
+    def start(self):
+        self._thread = threading.Thread(target=self._run, name="dumpulator-prefetch", daemon=True)
+        self._thread.start()
+
+    def wait(self):
+        if self._thread is not None:
+            self._thread.join()
+
+    def close(self):
+        self._stop = True
+        self.wait()
+        if not self._keep:
+            self._file.close()
+
 @dataclass
 class LazyPage:
     addr: int
     protect: MemoryProtect
     committed: bool
     data: Optional[bytearray] = None
+    # Offset of the page contents in LazyPageManager.backing (only used when data is None)
+    file_offset: Optional[int] = None
 
     @property
     def size(self):
         return PAGE_SIZE
 
+@dataclass
+class PageSnapshot:
+    pages: Dict[int, LazyPage]
+    total_commit: int
+    # Contents of the committed pages, captured right before they are modified
+    original: Dict[int, bytes] = field(default_factory=dict)
+
 @dataclass
 class LazyPageManager(PageManager):
     child: PageManager
     total_commit: int = 0
     pages: Dict[int, LazyPage] = field(default_factory=dict)
     lazy: bool = True
+    # Read-only mapping of the minidump (or a SegmentPrefetcher), referenced by LazyPage.file_offset
+    backing: Optional[Union[mmap.mmap, SegmentPrefetcher]] = None
+    # Copy-on-write tracking for the active snapshot
+    _snapshot: Optional[PageSnapshot] = None
+    # Pages that are write-protected in the child until their first modification
+    _clean: Set[int] = field(default_factory=set)
+    # Pages modified since the snapshot (or the last restore)
+    _dirty: Set[int] = field(default_factory=set)
+    # Called with (addr, size) when the contents of a range are changed through the page manager
+    on_write: Optional[Callable[[int, int], None]] = None
 
     @staticmethod
     def iter_pages(addr: int, size: int):
@@ -126,30 +233,204 @@ class LazyPageManager(PageManager):
 
     @staticmethod
     def iter_chunks(addr: int, size: int):
-        # TODO: rewrite this to not be so disgusting
-        page = addr & ~0xFFF
+        # Yields (page_addr, index, length) for every page touched by the range
+        end = addr + size
+        page_addr = addr & ~0xFFF
         index = addr & 0xFFF
-        while True:
-            if page >= addr + size:
-                break
-            length = min(PAGE_SIZE, (addr + size) - (page + index))
-            yield page, index, length
-            page += PAGE_SIZE
+        while page_addr < end:
+            length = min(PAGE_SIZE, end - page_addr) - index
+            yield page_addr, index, length
+            page_addr += PAGE_SIZE
             index = 0
 
+    def _find_pages(self, addr: int, size: int, operation: str):
+        # Returns the pages touched by the range and whether they are all committed
+        pages = self.pages
+        result: List[LazyPage] = []
+        committed = True
+        for page_addr in range(addr & ~0xFFF, addr + size, PAGE_SIZE):
+            page = pages.get(page_addr, None)
+            if page is None:
+                raise IndexError(f"Could not find page {hex(page_addr)} while {operation} {hex(addr)}[{hex(size)}]")
+            committed = committed and page.committed
+            result.append(page)
+        return result, committed
+
+    def _lazy_data(self, page: LazyPage):
+        # Contents of an uncommitted page (None if the page is all zeroes)
+        if page.data is not None:
+            return page.data
+        if page.file_offset is not None:
+            return self.backing[page.file_offset:page.file_offset + page.size]
+        return None
+
+    def _materialize(self, page: LazyPage) -> bytearray:
+        # Get a writable copy of the contents of an uncommitted page
+        if page.data is None:
+            data = self._lazy_data(page)
+            page.data = bytearray(page.size) if data is None else bytearray(data)
+            page.file_offset = None
+        return page.data
+
+    def map_backing(self, addr: int, size: int, file_offset: int, missing_ok=False) -> None:
+        """
+        Initialize the uncommitted pages in the range with the contents of the backing file. The data is only read
+        from the file when the page is accessed. With missing_ok pages that are not committed are skipped.
+        """
+        assert self.backing is not None
+        if self.on_write is not None:
+            self.on_write(addr, size)
+        if addr & 0xFFF != 0 or size & 0xFFF != 0:
+            data = self.backing[file_offset:file_offset + size]
+            if missing_ok:
+                self.write_mapped(addr, data)
+            else:
+                self.write(addr, data)
+            return
+        for page_addr in self.iter_pages(addr, size):
+            page = self.pages.get(page_addr, None)
+            if page is None:
+                if missing_ok:
+                    continue
+                raise IndexError(f"Could not find page {hex(page_addr)} while mapping {hex(addr)}[{hex(size)}]")
+            page_offset = file_offset + (page_addr - addr)
+            if page.committed:
+                self.child.write(page_addr, self.backing[page_offset:page_offset + page.size])
+            else:
+                page.data = None
+                page.file_offset = page_offset
+
+    def write_mapped(self, addr: int, data: bytes) -> None:
+        """
+        Write the parts of the range that are in the memory map, the pages that are not are skipped.
+        """
+        if all(page_addr in self.pages for page_addr in range(addr & ~0xFFF, addr + len(data), PAGE_SIZE)):
+            self.write(addr, data)
+            return
+        for page_addr, index, length in self.iter_chunks(addr, len(data)):
+            if page_addr in self.pages:
+                data_index = (page_addr + index) - addr
+                self.write(page_addr + index, data[data_index:data_index + length])
+
+    def _touch(self, page: LazyPage):
+        # Called before a page is modified while a snapshot is active
+        if self._snapshot is None or page.addr in self._dirty:
+            return
+        if page.committed:
+            if page.addr in self._snapshot.pages and page.addr not in self._snapshot.original:
+                self._snapshot.original[page.addr] = bytes(self.child.read(page.addr, page.size))
+            if page.addr in self._clean:
+                self._clean.remove(page.addr)
+                self.child.protect(page.addr, page.size, page.protect)
+        elif page.data is not None:
+            # The snapshot holds a reference to the original data
+            page.data = bytearray(page.data)
+        self._dirty.add(page.addr)
+
+    def _protect_clean(self, page_addrs: List[int]):
+        # Write-protect the pages in the child, merging adjacent pages with the same protection
+        run_start = None
+        run_size = 0
+        run_protect = None
+        for page_addr in sorted(page_addrs):
+            protect = self.pages[page_addr].protect.read_only()
+            if run_start is not None and run_start + run_size == page_addr and run_protect == protect:
+                run_size += PAGE_SIZE
+                continue
+            if run_start is not None:
+                self.child.protect(run_start, run_size, run_protect)
+            run_start = page_addr
+            run_size = PAGE_SIZE
+            run_protect = protect
+        if run_start is not None:
+            self.child.protect(run_start, run_size, run_protect)
+
+    def _release_snapshot(self):
+        for page_addr in self._clean:
+            page = self.pages[page_addr]
+            self.child.protect(page.addr, page.size, page.protect)
+        self._clean.clear()
+        self._dirty.clear()
+        self._snapshot = None
+
+    def snapshot(self) -> PageSnapshot:
+        self._release_snapshot()
+        pages = {page_addr: replace(page) for page_addr, page in self.pages.items()}
+        self._snapshot = PageSnapshot(pages, self.total_commit)
+        for page in self.pages.values():
+            if page.committed and page.protect.writable:
+                self._clean.add(page.addr)
+        self._protect_clean(list(self._clean))
+        return self._snapshot
+
+    def restore(self, snapshot: PageSnapshot) -> List[LazyPage]:
+        if snapshot is not self._snapshot:
+            raise ValueError("Only the most recent snapshot can be restored")
+
+        restored: List[LazyPage] = []
+        for page_addr in self._dirty:
+            page = self.pages.get(page_addr, None)
+            original = snapshot.pages.get(page_addr, None)
+            if original is None:
+                # The page was committed after the snapshot
+                if page is not None:
+                    if page.committed:
+                        self.child.decommit(page.addr, page.size)
+                    del self.pages[page_addr]
+                continue
+
+            if original.committed:
+                data = snapshot.original[page_addr]
+            else:
+                # Lazy pages are committed on restore so they do not fault every iteration
+                data = self._lazy_data(original)
+                data = bytes(PAGE_SIZE) if data is None else bytes(data)
+                original.committed = True
+                original.data = None
+                original.file_offset = None
+                snapshot.original[page_addr] = data
+
+            protect = original.protect
+            if protect.writable:
+                protect = protect.read_only()
+                self._clean.add(page_addr)
+            if page is None or not page.committed:
+                self.child.commit(page_addr, PAGE_SIZE, protect)
+            else:
+                self.child.protect(page_addr, PAGE_SIZE, protect)
+            self.child.write(page_addr, data)
+            page = LazyPage(page_addr, original.protect, True)
+            self.pages[page_addr] = page
+            restored.append(page)
+        self._dirty.clear()
+        self.total_commit = snapshot.total_commit
+        return restored
+
+    def handle_write_fault(self, addr: int, size: int) -> bool:
+        result = False
+        for page_addr, _, _ in self.iter_chunks(addr, size):
+            if page_addr in self._clean:
+                self._touch(self.pages[page_addr])
+                result = True
+        return result
+
     def handle_lazy_page(self, addr: int, size: int) -> bool:
         try:
             result = False
-            for page_addr, index, length in self.iter_chunks(addr, size):
-                page = self.pages.get(page_addr, None)
+            pages = self.pages
+            for page_addr in range(addr & ~0xFFF, addr + size, PAGE_SIZE):
+                page = pages.get(page_addr, None)
                 if page is None:
                     continue
                 if not page.committed:
+                    self._touch(page)
                     self.child.commit(page.addr, page.size, page.protect)
                     page.committed = True
-                    if page.data is not None:
-                        self.child.write(page.addr, page.data)
-                        page.data = None
+                    data = self._lazy_data(page)
+                    if data is not None:
+                        self.child.write(page.addr, data)
+                    page.data = None
+                    page.file_offset = None
                     result = True
             return result
         except UcError as err:
@@ -165,6 +446,8 @@ class LazyPageManager(PageManager):
         for page_addr in self.iter_pages(addr, size):
             assert page_addr not in self.pages
             self.pages[page_addr] = LazyPage(page_addr, protect, not self.lazy)
+            if self._snapshot is not None:
+                self._dirty.add(page_addr)
         self.total_commit += size
 
     def decommit(self, addr: int, size: int) -> None:
@@ -174,7 +457,9 @@ class LazyPageManager(PageManager):
         pages = []
         for page_addr in self.iter_pages(addr, size):
             assert page_addr in self.pages
-            pages.append(self.pages[page_addr])
+            page = self.pages[page_addr]
+            self._touch(page)
+            pages.append(page)
 
         if all(page.committed for page in pages):
             self.child.decommit(addr, size)
@@ -193,7 +478,9 @@ class LazyPageManager(PageManager):
         pages = []
         for page_addr in self.iter_pages(addr, size):
             assert page_addr in self.pages
-            pages.append(self.pages[page_addr])
+            page = self.pages[page_addr]
+            self._touch(page)
+            pages.append(page)
 
         if all(page.committed for page in pages):
             self.child.protect(addr, size, protect)
@@ -206,51 +493,118 @@ class LazyPageManager(PageManager):
             page.protect = protect
 
     def read(self, addr: int, size: int) -> bytearray:
-        pages = []
-        for page_addr, index, length in self.iter_chunks(addr, size):
-            page = self.pages.get(page_addr, None)
-            if page is None:
-                raise IndexError(f"Could not find page {hex(page_addr)} while reading {hex(addr)}[{hex(size)}]")
-            pages.append((page, index, length))
+        # Fast path: the majority of the accesses are small reads from a single committed page
+        index = addr & 0xFFF
+        if index + size <= PAGE_SIZE:
+            page = self.pages.get(addr - index, None)
+            if page is not None and page.committed:
+                return self.child.read(addr, size)
 
-        if all([page.committed for page, _, _ in pages]):
+        pages, committed = self._find_pages(addr, size, "reading")
+        if committed:
             return self.child.read(addr, size)
         else:
             data = bytearray(size)
-            for page, index, length in pages:
+            for page, (_, index, length) in zip(pages, self.iter_chunks(addr, size)):
                 data_index = (page.addr + index) - addr
                 if page.committed:
                     data[data_index:data_index + length] = self.child.read(page.addr + index, length)
                 else:
-                    if page.data is None:
-                        page.data = bytearray(page.size)
-                    data_chunk = page.data[index:index + length]
-                    data[data_index:data_index + length] = data_chunk
+                    page_data = self._lazy_data(page)
+                    if page_data is not None:
+                        data[data_index:data_index + length] = page_data[index:index + length]
             assert len(data) == size
             return data
 
     def write(self, addr: int, data: bytes) -> None:
-        pages = []
-        for page_addr, index, length in self.iter_chunks(addr, len(data)):
-            page = self.pages.get(page_addr, None)
-            if page is None:
-                raise IndexError(f"Could not find page {hex(page_addr)} while writing {hex(addr)}[{hex(len(data))}]")
-            pages.append((page, index, length))
+        if self.on_write is not None:
+            self.on_write(addr, len(data))
+        # Fast path: single committed page that does not need copy-on-write tracking
+        index = addr & 0xFFF
+        if index + len(data) <= PAGE_SIZE:
+            page = self.pages.get(addr - index, None)
+            if page is not None and page.committed and (self._snapshot is None or page.addr in self._dirty):
+                self.child.write(addr, data)
+                return
 
-        if all([page.committed for page, _, _ in pages]):
+        pages, committed = self._find_pages(addr, len(data), "writing")
+        for page in pages:
+            self._touch(page)
+
+        if committed:
             self.child.write(addr, data)
         else:
-            for page, index, length in pages:
+            for page, (_, index, length) in zip(pages, self.iter_chunks(addr, len(data))):
                 data_index = (page.addr + index) - addr
                 data_chunk = data[data_index:data_index + length]
                 assert len(data_chunk) == length
                 if page.committed:
                     self.child.write(page.addr + index, data_chunk)
                 else:
-                    if page.data is None:
-                        page.data = bytearray(page.size)
-                    page.data[index:index + length] = data_chunk
-                    assert len(page.data) == page.size
+                    page_data = self._materialize(page)
+                    page_data[index:index + length] = data_chunk
+                    assert len(page_data) == page.size
+
+    def accessible(self, addr: int, size: int, write: bool = False) -> bool:
+        # Whether the guest can access the whole range without faulting
+        pages = self.pages
+        for page_addr in range(addr & ~0xFFF, addr + size, PAGE_SIZE):
+            page = pages.get(page_addr, None)
+            if page is None:
+                return False
+            if not (page.protect.writable if write else page.protect.readable):
+                return False
+        return True
+
+    def copy(self, dst: int, src: int, size: int) -> None:
+        # memmove semantics, the source is read completely before anything is written
+        if size > 0:
+            self.write(dst, bytes(self.read(src, size)))
+
+    def fill(self, addr: int, size: int, value: int) -> None:
+        end = addr + size
+        run_start = addr
+        if value == 0:
+            # Zeroing a whole lazy page resets it without committing it
+            for page_addr, index, length in self.iter_chunks(addr, size):
+                page = self.pages.get(page_addr, None)
+                if page is None or page.committed or length != PAGE_SIZE:
+                    continue
+                if run_start < page_addr:
+                    self.write(run_start, bytes(page_addr - run_start))
+                if self.on_write is not None:
+                    self.on_write(page_addr, PAGE_SIZE)
+                self._touch(page)
+                page.data = None
+                page.file_offset = None
+                run_start = page_addr + PAGE_SIZE
+        if run_start < end:
+            self.write(run_start, bytes([value & 0xFF]) * (end - run_start))
+
+    def compare(self, a: int, b: int, size: int) -> int:
+        # Returns the index of the first differing byte (size if the ranges are equal)
+        offset = 0
+        while offset < size:
+            length = min(size - offset, 0x10000)
+            left = self.read(a + offset, length)
+            right = self.read(b + offset, length)
+            if left != right:
+                for i in range(length):
+                    if left[i] != right[i]:
+                        return offset + i
+            offset += length
+        return size
+
+@dataclass
+class DumpulatorSnapshot:
+    context: unicorn.UcContext
+    pages: PageSnapshot
+    memory: MemoryManagerSnapshot
+    handles: tuple
+    modules: Dict[int, Module]
+    module_names: Dict[str, int]
+    main_module: int
+    allocator: tuple
 
 class SimpleTimer:
     def __init__(self):
@@ -268,33 +622,72 @@ class SimpleTimer:
         print(f"{name}: {diff*1000:.0f}ms")
 
 class Dumpulator(Architecture):
-    def __init__(self, minidump_file, *, trace=False, quiet=False, thread_id=None, debug_logs=False):
+    def __init__(self, minidump_file, *, trace=False, quiet=False, thread_id=None, debug_logs=False, hle=True, export_cache=True, parallel_parse=False, progressive=False, profile=False, dpcache=False, overlay: Optional[str] = None):
         self._quiet = quiet
+        self.profiler: Optional[Profiler] = Profiler() if profile else None
+        self._export_cache = export_cache
+        self._parallel_parse = parallel_parse
+        self._progressive = progressive
+        self._prefetcher: Optional[SegmentPrefetcher] = None
         self._debug = debug_logs
         self.sequence_id = 0
 
-        # Load the minidump
-        self._minidump = minidump.MinidumpFile.parse(minidump_file)
-        if thread_id is None and self._minidump.exception is not None:
-            thread_id = self._minidump.exception.exception_records[0].ThreadId
+        # Load the minidump, with dpcache=True the streams are only parsed without a cache (see Dumpulator.prepare)
+        self._minidump: Optional[minidump.MinidumpFile] = None
+        self._dump_file = None
+        prepared = PreparedDump.load(cache_path(minidump_file), minidump_file) if dpcache else None
+        if prepared is None:
+            self._minidump = minidump.MinidumpFile.parse(minidump_file)
+            prepared = PreparedDump.from_minidump(self._minidump)
+        else:
+            self._dump_file = open(minidump_file, "rb")
+        self._overlay: Optional[PreparedDump] = None
+        if overlay is not None:
+            # Checkpoint written by save_dump(..., incremental=True): the state comes from the overlay and the pages
+            # that did not change are read from the original dump
+            overlay_dump = minidump.MinidumpFile.parse(overlay)
+            self._overlay = PreparedDump.from_minidump(overlay_dump)
+            overlay_dump.file_handle.close()
+            prepared = replace(self._overlay, filename=prepared.filename, segments=prepared.segments)
+        self._prepared = prepared
         if thread_id is None:
-            thread = self._minidump.threads.threads[0]
+            thread_id = prepared.exception_thread_id
+        if thread_id is None:
+            thread = prepared.threads[0]
         else:
             thread = self._find_thread(thread_id)
 
         self.thread_id = thread.ThreadId
-        self.process_id = self._minidump.misc_info.ProcessId
+        self.process_id = prepared.process_id
         self.parent_process_id = (self.process_id // 4 + 69) * 4
 
         super().__init__(type(thread.ContextObject) is not minidump.WOW64_CONTEXT)
         self.addr_mask = 0xFFFFFFFFFFFFFFFF if self._x64 else 0xFFFFFFFF
 
-        if trace:
+        if trace == "blocks":
+            self.trace = BlockTraceWriter(minidump_file + ".blocks")
+        elif trace == "binary":
+            self.trace = BinaryTraceWriter(minidump_file + ".trace.bin", self._x64)
+        elif trace == "zstd":
+            self.trace = BinaryTraceWriter(minidump_file + ".trace.zst", self._x64, compress=True)
+        elif trace:
             self.trace = open(minidump_file + ".trace", "w")
         else:
             self.trace = None
+        # With a code hook on every instruction the first memory exception is already precise
+        self._precise_trace = self.trace is not None and not isinstance(self.trace, BlockTraceWriter)
+        # Memory faults for which unicorn reports the faulting instruction directly, the single step restart can be
+        # skipped for those
+        block_hook = profile or isinstance(self.trace, BlockTraceWriter)
+        self._precise_exceptions = _probe_precise_exceptions(block_hook)
 
         self.last_module: Optional[Module] = None
+        # Decoded instructions for the trace, indexed by page and then by address
+        self._decode_cache: Dict[int, Dict[int, DecodedInstruction]] = {}
+        # UC_HOOK_MEM_WRITE hooks of the pages in the decode cache, to invalidate them for self-modifying code
+        self._decode_hooks: Dict[int, int] = {}
+        # Emulation of the instructions unicorn does not support, indexed by address
+        self._unsupported_cache: Dict[int, CompiledInstruction] = {}
 
         self._uc = Uc(UC_ARCH_X86, UC_MODE_64)
 
@@ -312,13 +705,11 @@ class Dumpulator(Architecture):
             pass
 
         self.regs = Registers(self._uc, self._x64)
-        self._pages = LazyPageManager(UnicornPageManager(self._uc))
+        self._pages = LazyPageManager(UnicornPageManager(self._uc), on_write=self._invalidate_decode_cache)
         self.memory = MemoryManager(self._pages)
         self.args = Arguments(self._uc, self._pages, self.regs, self._x64)
         self.modules = ModuleManager(self.memory)
-        self._allocate_base = None
-        self._allocate_size = 1024 * 1024 * 10  # NOTE: 10 megs
-        self._allocate_ptr = None
+        self._allocator = ScratchAllocator(self.memory)
         self._setup_memory()
         self.debug(f"total commit: {hex(self._pages.total_commit)}, pages: {self._pages.total_commit // PAGE_SIZE}")
         self._setup_modules()
@@ -326,13 +717,18 @@ class Dumpulator(Architecture):
         self.win32k_syscalls = []
         self._setup_syscalls()
         self._setup_emulator(thread)
+        self.scheduler = Scheduler(self, self.thread_id, self.teb)
+        self._thread_exit_hook = None
         self.handles = HandleManager()
         self._setup_handles()
         self._setup_registry()
         self.stopped = False
         self.kill_exception = None
         self.exit_code = None
-        self.exports = self._all_exports()
+        self.exports = ModuleSymbols(self.modules)
+        self._hle_hooks: Dict[int, int] = {}
+        if hle:
+            self._setup_hle()
         self._exception = UnicornExceptionInfo()
         self._last_exception: Optional[UnicornExceptionInfo] = None
         self._exception_hook: Optional[Callable[[ExceptionInfo], Optional[int]]] = None
@@ -365,9 +761,58 @@ class Dumpulator(Architecture):
             table.append(entry)
         print(format_table(table))
 
+    @staticmethod
+    def prepare(minidump_file: str, **kwargs) -> str:
+        """
+        Write the .dpcache sidecar of a dump: the region map, the file offsets of the memory segments, the module
+        tables, the syscall tables and the locations of the thread contexts. Dumpulator(minidump_file, dpcache=True)
+        loads this instead of parsing the minidump. The cache is ignored when the dump is modified. Returns the path of
+        the cache.
+        """
+        if kwargs.get("overlay", None) is not None:
+            raise ValueError("The cache can only be prepared for the original dump")
+        kwargs.setdefault("quiet", True)
+        dp = Dumpulator(minidump_file, dpcache=False, **kwargs)
+        path = cache_path(minidump_file)
+        dp._prepared.save(path)
+        return path
+
+    @property
+    def _dump_handle(self):
+        return self._dump_file if self._minidump is None else self._minidump.file_handle
+
+    def close(self):
+        """
+        Stop the background prefetching and close the dump. The emulator cannot be used afterwards. This also
+        happens when a `with Dumpulator(...) as dp:` block exits or the emulator is garbage collected.
+        """
+        # The attributes are looked up with getattr because the constructor might not have finished
+        prefetcher = getattr(self, "_prefetcher", None)
+        if prefetcher is not None:
+            self._prefetcher = None
+            prefetcher.close()
+        pages = getattr(self, "_pages", None)
+        if pages is not None and isinstance(pages.backing, mmap.mmap):
+            pages.backing.close()
+        dump_file = getattr(self, "_dump_file", None)
+        if dump_file is not None:
+            self._dump_file = None
+            dump_file.close()
+        dump = getattr(self, "_minidump", None)
+        if dump is not None:
+            dump.file_handle.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
     def _find_thread(self, thread_id):
-        for i in range(0, len(self._minidump.threads.threads)):
-            thread = self._minidump.threads.threads[i]
+        for thread in self._prepared.threads:
             if thread.ThreadId == thread_id:
                 return thread
         raise Exception(f"Thread {hex(thread_id)} ({thread_id}) not found!")
@@ -405,55 +850,78 @@ class Dumpulator(Architecture):
             self.write(GDT_BASE + 8 * i, struct.pack("<Q", windows_gdt[i]))
         self.regs.gdtr = (0, GDT_BASE, 8 * len(windows_gdt) - 1, 0x0)
 
+    def _map_minidump(self) -> Optional[mmap.mmap]:
+        # Dumps parsed from a buffer (parse_external/parse_bytes) do not have a file descriptor
+        try:
+            fileno = self._dump_handle.fileno()
+            return mmap.mmap(fileno, 0, access=mmap.ACCESS_READ)
+        except (AttributeError, OSError, ValueError) as err:
+            self.debug(f"failed to map the minidump ({err}), reading the memory instead")
+            return None
+
     def _setup_memory(self):
-        info: minidump.MinidumpMemoryInfo
-        regions: List[List[minidump.MinidumpMemoryInfo]] = []
-        mask = 0xFFFFFFFFFFFFFFFF if self._x64 else 0xFFFFFFFF
-        for info in self._minidump.memory_info.infos:
-            info.AllocationBase &= mask
-            info.BaseAddress &= mask
-            if len(regions) == 0 or info.AllocationBase != regions[-1][0].AllocationBase or info.State == minidump.MemoryState.MEM_FREE:
-                regions.append([])
-            regions[-1].append(info)
         # NOTE: The HYPERVISOR_SHARED_DATA does not respect the allocation granularity
         potential_hv = []
         old_granularity = self.memory._granularity
         self.memory._granularity = PAGE_SIZE
-        for i in range(len(regions)):
-            region = regions[i]
-            reserve_addr = None
-            reserve_size = 0
-            assert len(region) >= 1
-            for j in range(len(region)):
-                info = region[j]
-                if reserve_addr is None:
-                    reserve_addr = info.BaseAddress
-                reserve_size += info.RegionSize
-            info = region[0]
-            if info.State == minidump.MemoryState.MEM_FREE:
-                continue
-            reserve_protect = MemoryProtect(info.AllocationProtect)
-            reserve_type = MemoryType(info.Type.value)
-            self.debug(f" reserved: {hex(reserve_addr)}, size: {hex(reserve_size)}, protect: {reserve_protect}, type: {reserve_type}")
-            self.memory.reserve(reserve_addr, reserve_size, reserve_protect, reserve_type)
+        for region in self._prepared.regions:
+            reserve_addr = region.base & self.addr_mask
+            reserve_protect = MemoryProtect(region.protect)
+            reserve_type = MemoryType(region.type)
+            self.debug(f" reserved: {hex(reserve_addr)}, size: {hex(region.size)}, protect: {reserve_protect}, type: {reserve_type}")
+            self.memory.reserve(reserve_addr, region.size, reserve_protect, reserve_type)
             if reserve_addr & (old_granularity - 1) != 0:
                 potential_hv.append(reserve_addr)
-            for info in region:
-                emu_addr = info.BaseAddress & self.addr_mask
-                if info.State == minidump.MemoryState.MEM_COMMIT:
-                    protect = reserve_protect if info.Protect is None else MemoryProtect(info.Protect.value)
-                    self.debug(f"committed: {hex(emu_addr)}, size: {hex(info.RegionSize)}, protect: {protect}")
-                    self.memory.commit(info.BaseAddress, info.RegionSize, protect)
+            for commit_addr, commit_size, commit_protect in region.commits:
+                emu_addr = commit_addr & self.addr_mask
+                protect = reserve_protect if commit_protect is None else MemoryProtect(commit_protect)
+                self.debug(f"committed: {hex(emu_addr)}, size: {hex(commit_size)}, protect: {protect}")
+                self.memory.commit(emu_addr, commit_size, protect)
         self.memory._granularity = old_granularity
-        memory = self._minidump.get_reader().get_buffered_reader()
-        seg: minidump.MinidumpMemorySegment
-        for seg in self._minidump.memory_segments_64.memory_segments:
-            emu_addr = seg.start_virtual_address & self.addr_mask
-            self.debug(f"initialize base: {hex(emu_addr)}, size: {hex(seg.size)}")
-            memory.move(seg.start_virtual_address)
-            assert memory.current_position == seg.start_virtual_address
-            data = memory.read(seg.size)
-            self._pages.write(emu_addr, data)
+        segments = self._prepared.segments
+        ranges = [(file_offset, size) for _, size, file_offset in segments]
+        # The pages released before the overlay was written are not in the memory map
+        missing_ok = self._overlay is not None
+        backing = self._map_minidump()
+        if backing is None and self._progressive:
+            # The segments are read in the background, pages that are accessed before that are read synchronously
+            backing = self._prefetcher = SegmentPrefetcher(self._dump_handle, ranges, keep=True)
+        elif backing is not None and self._progressive:
+            # Warm up the page cache with a separate handle, so the first access to a page does not wait for the disk
+            try:
+                self._prefetcher = SegmentPrefetcher(open(self._prepared.filename, "rb"), ranges, keep=False)
+            except (OSError, TypeError) as err:
+                self.debug(f"failed to open the minidump for prefetching ({err})")
+        if backing is None and self._minidump is None:
+            # Fall back to reading the memory with the minidump parser
+            self._minidump = minidump.MinidumpFile.parse(self._prepared.filename)
+        if backing is not None:
+            # The page contents are read from the file on first access
+            self._pages.backing = backing
+            for virtual_address, size, file_offset in segments:
+                emu_addr = virtual_address & self.addr_mask
+                self.debug(f"initialize base: {hex(emu_addr)}, size: {hex(size)}, offset: {hex(file_offset)}")
+                self._pages.map_backing(emu_addr, size, file_offset, missing_ok=missing_ok)
+            if self._prefetcher is not None:
+                self._prefetcher.start()
+        else:
+            memory = self._minidump.get_reader().get_buffered_reader()
+            seg: minidump.MinidumpMemorySegment
+            for seg in self._minidump.memory_segments_64.memory_segments:
+                emu_addr = seg.start_virtual_address & self.addr_mask
+                self.debug(f"initialize base: {hex(emu_addr)}, size: {hex(seg.size)}")
+                memory.move(seg.start_virtual_address)
+                assert memory.current_position == seg.start_virtual_address
+                data = memory.read(seg.size)
+                if missing_ok:
+                    self._pages.write_mapped(emu_addr, data)
+                else:
+                    self._pages.write(emu_addr, data)
+        if self._overlay is not None:
+            with open(self._overlay.filename, "rb") as f:
+                for virtual_address, size, file_offset in self._overlay.segments:
+                    f.seek(file_offset)
+                    self._pages.write(virtual_address & self.addr_mask, f.read(size))
         self._pages.lazy = False
 
         self.memory.set_region_info(0x7ffe0000, "KUSER_SHARED_DATA")
@@ -490,8 +958,7 @@ class Dumpulator(Architecture):
             self.wow64 = False
 
         # Get thread information
-        for i in range(0, len(self._minidump.threads.threads)):
-            thread = self._minidump.threads.threads[i]
+        for thread in self._prepared.threads:
             teb = thread.Teb & 0xFFFFFFFFFFFFF000
             tid = thread.ThreadId
             if self._x64:
@@ -568,10 +1035,8 @@ class Dumpulator(Architecture):
         self.info(f"  StandardOutput: {hex(self.stdout_handle)}")
         self.info(f"  StandardError: {hex(self.stderr_handle)}")
 
-        process_heaps = []
-        for i in range(0, min(number_of_heaps, 0x1000)):
-            heap_ptr = self.read_ptr(process_heaps_ptr + self.ptr_size() * i)
-            process_heaps.append(heap_ptr)
+        process_heaps = list(self.read_ptrs(process_heaps_ptr, min(number_of_heaps, 0x1000)))
+        for i, heap_ptr in enumerate(process_heaps):
             self.memory.set_region_info(heap_ptr, f"Heap (ID {i})")
 
         self.memory.set_region_info(api_set_map, "ApiSetMap")
@@ -612,24 +1077,16 @@ class Dumpulator(Architecture):
             self.handles.add(self.stderr_handle, self.stderr)
 
         # TODO: attempt to extract handles from the dump stream and add them as UnknownObject
-        if self._minidump.handles is not None:
-            by_type: Dict[str, List[minidump.MinidumpHandleDescriptor]] = {}
-            minidump_handle: minidump.MinidumpHandleDescriptor
-            for minidump_handle in self._minidump.handles.handles:
-                type_name = minidump_handle.TypeName
+        if self._prepared.handles:
+            by_type: Dict[str, List[Tuple[int, Optional[str]]]] = {}
+            for handle_value, type_name, object_name in self._prepared.handles:
                 if type_name is None:
                     type_name = "Unknown"
                 if type_name not in by_type:
                     by_type[type_name] = []
-                by_type[type_name].append(minidump_handle)
-            def default_fn(o):
-                if isinstance(o, bytes):
-                    return o.hex()
-                else:
-                    return o.__dict__
+                by_type[type_name].append((handle_value, object_name))
             for type_name, handles in by_type.items():
-                for minidump_handle in handles:
-                    handle_value = minidump_handle.Handle
+                for handle_value, object_name in handles:
                     handle_data = self.handles.get(handle_value, None)
                     if handle_data is not None:
                         self.debug(f"handle already added: {hex(handle_value)} = {self.handles.get(handle_value, None)}")
@@ -639,7 +1096,7 @@ class Dumpulator(Architecture):
                     if type_name == "Unknown":
                         obj = UnknownObject()
                     elif type_name == "File":
-                        path = minidump_handle.ObjectName
+                        path = object_name
                         if path is None:
                             path = "???"
                         obj = AbstractFileObject(path)
@@ -649,7 +1106,7 @@ class Dumpulator(Architecture):
                         event_signalled = False
                         obj = EventObject(event_type, event_signalled)
                     elif type_name == "Key":
-                        key = minidump_handle.ObjectName
+                        key = object_name
                         if key is None:
                             key = "???"
                         obj = RegistryKeyObject(key)
@@ -762,19 +1219,37 @@ class Dumpulator(Architecture):
         self._uc.hook_add(UC_HOOK_MEM_INVALID, _hook_mem, user_data=self)
         self._uc.hook_add(UC_HOOK_INTR, _hook_interrupt, user_data=self)
         self._uc.hook_add(UC_HOOK_INSN_INVALID, _hook_invalid, user_data=self)
-        if self.trace:
+        if isinstance(self.trace, BlockTraceWriter):
+            self._uc.hook_add(UC_HOOK_BLOCK, _hook_block, user_data=self)
+        elif isinstance(self.trace, BinaryTraceWriter):
+            self._uc.hook_add(UC_HOOK_CODE, _hook_code_binary, user_data=self)
+        elif self.trace:
             self._uc.hook_add(UC_HOOK_CODE, _hook_code, user_data=self)
+        if self.profiler is not None:
+            self._uc.hook_add(UC_HOOK_BLOCK, _hook_profile_block, user_data=self)
 
-    def _all_exports(self):
-        exports: Dict[int, str] = {}
-        for module in self.modules:
-            for export in module.exports:
-                if export.name:
-                    name = export.name
-                else:
-                    name = f"#{export.ordinal}"
-                exports[export.address] = f"{module.name}:{name}"
-        return exports
+    def _setup_hle(self):
+        for (module_name, export_name), function in hle_functions.items():
+            module = self.modules.find(module_name)
+            if module is None:
+                continue
+            export = module.find_export(export_name)
+            if export is None or export.forward is not None:
+                continue
+            self.install_hle(export.address, function)
+
+    def install_hle(self, address: int, function: "HleFunction"):
+        # A single code hook on the first instruction of the export
+        if address in self._hle_hooks:
+            self._uc.hook_del(self._hle_hooks[address])
+        self._hle_hooks[address] = self._uc.hook_add(UC_HOOK_CODE, _hook_hle, user_data=(self, function), begin=address, end=address)
+
+    def _setup_thread_exit(self):
+        # Threads created by the guest return to THREAD_EXIT_ADDR (jmp $) when their start routine finishes
+        if self._thread_exit_hook is not None:
+            return
+        self._pages.write(THREAD_EXIT_ADDR, b"\xEB\xFE")
+        self._thread_exit_hook = self._uc.hook_add(UC_HOOK_CODE, _hook_thread_exit, user_data=self, begin=THREAD_EXIT_ADDR, end=THREAD_EXIT_ADDR)
 
     def _parse_module_exports(self, module):
         try:
@@ -792,55 +1267,86 @@ class Dumpulator(Architecture):
         pe.parse_data_directories(directories=[DIRECTORY_ENTRY["IMAGE_DIRECTORY_ENTRY_EXPORT"]])
         return pe.DIRECTORY_ENTRY_EXPORT.symbols if hasattr(pe, "DIRECTORY_ENTRY_EXPORT") else []
 
-    def _setup_modules(self):
-        minidump_module: minidump.MinidumpModule
-        for minidump_module in self._minidump.modules.modules:
-            base = minidump_module.baseaddress
-            size = minidump_module.size
-            path = minidump_module.name
+    def _read_module_image(self, base: int, size: int) -> bytearray:
+        # Read as much data from the module memory as possible
+        try:
+            return self.read(base, size)
+        except IndexError:
+            # HACK: modules with holes between sections need to be read in chunks
+            mapped_data = bytearray(size)
+            ptr = base
+            while ptr < base + size:
+                region = self.memory.query(ptr)
+                if region.state == MemoryState.MEM_COMMIT:
+                    data = self.read(region.base, region.region_size)
+                    index = region.base - base
+                    mapped_data[index:index + len(data)] = data
+                ptr += region.region_size
+            assert len(mapped_data) == size
+            return mapped_data
+
+    def _module_image_key(self, base: int) -> Optional[Tuple[int, int]]:
+        # TimeDateStamp and SizeOfImage from the headers in memory, used as the export cache key
+        try:
+            nt_headers = base + self.read_ulong(base + 0x3C)
+            if self.read(nt_headers, 4) != b"PE\0\0":
+                return None
+            timestamp = self.read_ulong(nt_headers + 0x8)
+            size_of_image = self.read_ulong(nt_headers + 0x18 + 0x38)
+            return timestamp, size_of_image
+        except IndexError:
+            return None
 
-            # Read as much data from the module memory as possible
-            try:
-                mapped_data = self.read(base, size)
-            except IndexError:
-                # HACK: modules with holes between sections need to be read in chunks
-                mapped_data = bytearray(size)
-                ptr = base
-                while ptr < base + size:
-                    region = self.memory.query(ptr)
-                    if region.state == MemoryState.MEM_COMMIT:
-                        data = self.read(region.base, region.region_size)
-                        index = region.base - base
-                        mapped_data[index:index + len(data)] = data
-                    ptr += region.region_size
-                assert len(mapped_data) == size
+    def _load_module_pe(self, base: int, size: int) -> PE:
+        # Load the PE dumped from memory
+        pe = PE(data=self._read_module_image(base, size), fast_load=True)
+        for section in pe.sections:
+            # HACK: adjust pefile to accept in-memory modules
+            # Potentially interesting members: Misc_PhysicalAddress, Misc_VirtualSize, SizeOfRawData
+            section.PointerToRawData = section.VirtualAddress
+            section.PointerToRawData_adj = section.VirtualAddress
+        # Do not trust these values from memory
+        pe.OPTIONAL_HEADER.ImageBase = base
+        pe.OPTIONAL_HEADER.SizeOfImage = size
+        return pe
 
-            try:
-                # Load the PE dumped from memory
-                pe = PE(data=mapped_data, fast_load=True)
-                section_alignment = pe.OPTIONAL_HEADER.SectionAlignment
-                for section in pe.sections:
-                    # Set the section in the memory region
-                    name = section.Name.rstrip(b"\0").decode(encoding="ascii", errors="backslashreplace")
-                    mask = section_alignment - 1
-                    index = (section.VirtualAddress + mask) & ~mask
-                    section_size = self.memory.align_page(section.Misc_VirtualSize)
-                    va = base + index
-                    for page in range(va, va + section_size, PAGE_SIZE):
-                        region = self.memory.find_commit(page)
-                        if region is not None:
-                            region.info = name
-                    # HACK: adjust pefile to accept in-memory modules
-                    # Potentially interesting members: Misc_PhysicalAddress, Misc_VirtualSize, SizeOfRawData
-                    section.PointerToRawData = section.VirtualAddress
-                    section.PointerToRawData_adj = section.VirtualAddress
-            except pefile.PEFormatError as e:
+    def _setup_modules(self):
+        cache = ExportCache() if self._export_cache else None
+        # The modules are parsed from memory only when they are not in the cache
+        entries = self._prepared.modules
+        misses: List[int] = []
+        for index, entry in enumerate(entries):
+            base, size, path, key, table = entry
+            if table is not None:
+                # Loaded from the prepared cache
+                continue
+            key = entry[3] = self._module_image_key(base)
+            if cache is not None and key is not None:
+                table = entry[4] = cache.load(path, *key)
+            if table is None:
+                misses.append(index)
+
+        images = [self._read_module_image(entries[index][0], entries[index][1]) for index in misses]
+        for index, table in zip(misses, parse_images(images, self._parallel_parse)):
+            base, size, path, key, _ = entries[index]
+            if table is None:
                 self.error(f"Failed to parse module {hex(base)}[{hex(size)}]: {path}")
-
-            # Do not trust these values from memory
-            pe.OPTIONAL_HEADER.ImageBase = base
-            pe.OPTIONAL_HEADER.SizeOfImage = size
-            self.modules.add(pe, path)
+                table = ModuleTable(0, PAGE_SIZE, [], [])
+            elif cache is not None and key is not None:
+                cache.store(path, *key, table)
+            entries[index][4] = table
+
+        for base, size, path, _, table in entries:
+            mask = table.section_alignment - 1
+            for name, rva, virtual_size in table.sections:
+                # Set the section in the memory region
+                index = (rva + mask) & ~mask
+                section_size = self.memory.align_page(virtual_size)
+                self.memory.set_commit_info(base + index, section_size, name)
+
+            def pe_loader(base=base, size=size):
+                return self._load_module_pe(base, size)
+            self.modules.add_module(Module(None, path, base=base, size=size, table=table, _pe_loader=pe_loader))
 
     def _setup_syscalls(self):
         # Load the ntdll module from memory
@@ -848,33 +1354,31 @@ class Dumpulator(Architecture):
         self.KiUserExceptionDispatcher = ntdll.find_export("KiUserExceptionDispatcher").address
         self.LdrLoadDll = ntdll.find_export("LdrLoadDll").address
 
-        nt_syscalls = []
-        for export in ntdll.exports:
-            if export.name and export.name.startswith("Zw"):
-                nt_syscalls.append((export.address, export.name))
-
-        def add_syscalls(syscalls, table):
-            # The index when sorting by RVA is the syscall index
-            syscalls.sort()
-            for index, (rva, name) in enumerate(syscalls):
+        def add_syscalls(names, table):
+            for name in names:
                 cb = syscall_functions.get(name, None)
-                argcount = 0
+                arguments = ()
                 if cb:
-                    argspec = inspect.getfullargspec(cb)
-                    argcount = len(argspec.args) - 1
-                table.append((name, cb, argcount))
-
-        add_syscalls(nt_syscalls, self.syscalls)
+                    arguments = syscall_marshallers.get(cb, None)
+                    if arguments is None:
+                        arguments = _compile_syscall(cb)
+                        syscall_marshallers[cb] = arguments
+                table.append((name, cb, arguments))
 
-        # Get the syscalls for win32u
-        win32u = self.modules.find("win32u.dll")
-        if win32u is not None:
-            win32k_syscalls = []
-            for export in win32u.exports:
-                if export.name and export.name.startswith("Nt"):
-                    win32k_syscalls.append((export.address, export.name))
+        def sorted_names(module, prefix):
+            # The index when sorting by RVA is the syscall index
+            syscalls = [(export.address, export.name) for export in module.exports if export.name and export.name.startswith(prefix)]
+            syscalls.sort()
+            return [name for _, name in syscalls]
 
-            add_syscalls(win32k_syscalls, self.win32k_syscalls)
+        prepared = self._prepared
+        if prepared.nt_syscalls is None:
+            prepared.nt_syscalls = sorted_names(ntdll, "Zw")
+            # Get the syscalls for win32u
+            win32u = self.modules.find("win32u.dll")
+            prepared.win32k_syscalls = sorted_names(win32u, "Nt") if win32u is not None else []
+        add_syscalls(prepared.nt_syscalls, self.syscalls)
+        add_syscalls(prepared.win32k_syscalls, self.win32k_syscalls)
 
 
     def push(self, value):
@@ -890,7 +1394,7 @@ class Dumpulator(Architecture):
 
     def ret(self, imm=0):
         return_address = self.pop()
-        self.regs.csp -= imm
+        self.regs.csp += imm
         return return_address
 
     def read(self, addr, size):
@@ -903,6 +1407,28 @@ class Dumpulator(Architecture):
             addr = int(addr)
         self._pages.write(addr, bytes(data))
 
+    def _cache_decoded_page(self, page: int) -> Dict[int, "DecodedInstruction"]:
+        # Instructions can cross into the next page, so writes to that page invalidate this one as well
+        self._decode_hooks[page] = self._uc.hook_add(UC_HOOK_MEM_WRITE, _hook_mem_write, user_data=self, begin=page, end=page + 2 * PAGE_SIZE - 1)
+        page_cache = {}
+        self._decode_cache[page] = page_cache
+        return page_cache
+
+    def _invalidate_decode_cache(self, addr: int, size: int):
+        if not self._decode_cache:
+            return
+        page = (addr & ~0xFFF) - PAGE_SIZE
+        while page < addr + size:
+            if self._decode_cache.pop(page, None) is not None:
+                self._uc.hook_del(self._decode_hooks.pop(page))
+            page += PAGE_SIZE
+
+    def _clear_decode_cache(self):
+        for hook in self._decode_hooks.values():
+            self._uc.hook_del(hook)
+        self._decode_hooks.clear()
+        self._decode_cache.clear()
+
     def call(self, addr, args: List[int] = None, regs: dict = None, count=0):
         if args is None:
             args = []
@@ -929,29 +1455,94 @@ class Dumpulator(Architecture):
         return self.regs.cax
 
     def allocate(self, size, page_align=False):
-        if not self._allocate_ptr:
-            self._allocate_base = self.memory.find_free(self._allocate_size)
-            assert self._allocate_base is not None, "Failed to find free memory"
-            self.memory.reserve(
-                start=self._allocate_base,
-                size=self._allocate_size,
-                protect=MemoryProtect.PAGE_EXECUTE_READWRITE,
-                memory_type=MemoryType.MEM_PRIVATE,
-                info="allocated region"
-            )
-            self._allocate_ptr = self._allocate_base
-
-        if page_align:
-            self._allocate_ptr = round_to_pages(self._allocate_ptr)
-            size = round_to_pages(size)
-
-        if self._allocate_ptr + size > self._allocate_base + self._allocate_size:
-            raise Exception("not enough room to allocate!")
-
-        ptr = self._allocate_ptr
-        self._allocate_ptr += size
-        self.memory.commit(self.memory.align_page(ptr), self.memory.align_page(size))
-        return ptr
+        """
+        Allocate scratch memory (read/write/execute) for the emulated code. Memory that was released with free() or
+        by an arena() scope is reused without being cleared.
+        """
+        return self._allocator.allocate(size, page_align)
+
+    def free(self, ptr: int):
+        """
+        Release memory returned by allocate() so later allocations of the same size class can reuse it.
+        """
+        self._allocator.free(ptr)
+
+    @contextmanager
+    def arena(self):
+        """
+        Scope for scratch allocations, everything allocated inside the with block is released when it exits:
+
+            with dp.arena():
+                buffer = dp.allocate(0x100)
+                dp.call(func, [buffer])
+        """
+        mark = self._allocator.mark()
+        try:
+            yield
+        finally:
+            # A snapshot restored inside the block might predate the mark, the allocations are already gone then
+            if self._allocator.has_mark(mark):
+                self._allocator.reset(mark)
+
+    def _snapshot_memo(self, scheduler: Scheduler):
+        # The objects can reference the Dumpulator instance and the (immutable) thread contexts, which should not be copied
+        memo = {id(self): self}
+        for thread in scheduler.threads.values():
+            if thread.context is not None:
+                memo[id(thread.context)] = thread.context
+        return memo
+
+    def _snapshot_handles(self):
+        import copy
+        # The scheduler is copied together with the handles, it references the same thread and event objects
+        state = (self.handles, self.console, self.stdin, self.stdout, self.stderr, self.scheduler)
+        return copy.deepcopy(state, self._snapshot_memo(self.scheduler))
+
+    def snapshot(self) -> DumpulatorSnapshot:
+        """
+        Take a snapshot of the emulator state. Pages are only copied when they are modified after the snapshot,
+        which makes restoring a snapshot cheap when only a small part of the memory changed.
+        Only the most recent snapshot can be restored, but it can be restored any number of times.
+        """
+        return DumpulatorSnapshot(
+            context=self._uc.context_save(),
+            pages=self._pages.snapshot(),
+            memory=self.memory.snapshot(),
+            handles=self._snapshot_handles(),
+            modules=dict(self.modules._modules),
+            module_names=dict(self.modules._name_lookup),
+            main_module=self.modules.main,
+            allocator=self._allocator.snapshot(),
+        )
+
+    def restore(self, snapshot: DumpulatorSnapshot):
+        for page in self._pages.restore(snapshot.pages):
+            if page.protect.executable:
+                # Make sure no stale translation blocks are executed
+                self._uc.ctl_remove_cache(page.addr, page.addr + page.size)
+        self._clear_decode_cache()
+        if self.profiler is not None:
+            self.profiler.invalidate_blocks()
+        self.memory.restore(snapshot.memory)
+        self._uc.context_restore(snapshot.context)
+
+        import copy
+        state = copy.deepcopy(snapshot.handles, self._snapshot_memo(snapshot.handles[-1]))
+        self.handles, self.console, self.stdin, self.stdout, self.stderr, self.scheduler = state
+        self.thread_id = self.scheduler.current.thread_id
+        self.teb = self.scheduler.current.teb
+        self.modules._modules = dict(snapshot.modules)
+        self.modules._name_lookup = dict(snapshot.module_names)
+        self.modules._bases = sorted(snapshot.modules)
+        self.modules.main = snapshot.main_module
+        self._allocator.restore(snapshot.allocator)
+
+        self.stopped = False
+        self.kill_exception = None
+        self.exit_code = None
+        self.last_module = None
+        self._exception = UnicornExceptionInfo()
+        self._last_exception = None
 
     def set_exception_hook(self, exception_hook: Optional[Callable[[ExceptionInfo], Optional[int]]]):
         previous_hook = self._exception_hook
@@ -1104,7 +1695,7 @@ rsp in KiUserExceptionDispatcher:
         self._exception = UnicornExceptionInfo()
         emu_begin = begin
         emu_until = end
-        emu_count = count
+        emu_count, sliced = self._time_slice(count)
         while not self.stopped:
             try:
                 if self._exception.type != ExceptionType.NoException:
@@ -1119,7 +1710,13 @@ rsp in KiUserExceptionDispatcher:
                             break
 
                         try:
-                            emu_begin = self.handle_exception()
+                            if self.profiler is not None:
+                                exception_start = time.perf_counter()
+                                exception_name = self._exception.type.name
+                                emu_begin = self.handle_exception()
+                                self.profiler.add("exception", exception_name, time.perf_counter() - exception_start)
+                            else:
+                                emu_begin = self.handle_exception()
                             if self.stopped:
                                 break
                         except Exception:
@@ -1127,7 +1724,7 @@ rsp in KiUserExceptionDispatcher:
                             self.error(f"exception during exception handling (stack overflow?)")
                             break
                         emu_until = end
-                        emu_count = 0
+                        emu_count, sliced = self._time_slice(count)
                     else:
                         # If this happens there was an error restarting simulation
                         assert self._exception.step_count == 0
@@ -1144,9 +1741,24 @@ rsp in KiUserExceptionDispatcher:
                         emu_begin = self.regs.cip
                         emu_until = 0xffffffffffffffff
                         emu_count = self._exception.tb_icount + 1
+                        sliced = False
 
                 self.info(f"emu_start({hex(emu_begin)}, {hex(emu_until)}, {emu_count})")
-                self._uc.emu_start(emu_begin, until=emu_until, count=emu_count)
+                if self.profiler is not None:
+                    kind = "restart" if self._exception.code_hook_h is not None else "emu_start"
+                    emu_start = time.perf_counter()
+                    try:
+                        self._uc.emu_start(emu_begin, until=emu_until, count=emu_count)
+                    finally:
+                        self.profiler.add("emulation", kind, time.perf_counter() - emu_start)
+                else:
+                    self._uc.emu_start(emu_begin, until=emu_until, count=emu_count)
+                if sliced and not self.stopped and self.regs.cip != end:
+                    # The time slice ran out, let the other threads run
+                    self.scheduler.preempt()
+                    emu_begin = self.regs.cip
+                    emu_count, sliced = self._time_slice(count)
+                    continue
                 self.info(f'emulation finished, cip = {hex(self.regs.cip)}')
                 if self.exit_code is not None:
                     self.info(f"exit code: {hex(self.exit_code)}")
@@ -1161,6 +1773,37 @@ rsp in KiUserExceptionDispatcher:
                     self.error(f'error: {err}, cip = {hex(self.regs.cip)}')
                     traceback.print_exc()
                 break
+        if self.trace is not None:
+            self.trace.flush()
+
+    def profile_report(self, top: Optional[int] = 20) -> str:
+        """
+        Returns a report of the time spent per syscall, hook, exception and module (requires profile=True).
+        """
+        assert self.profiler is not None, "Profiling is not enabled, pass profile=True"
+        return self.profiler.report(top, self.handles.statistics())
+
+    def save_dump(self, path: str, incremental=False) -> int:
+        """
+        Write the current state (memory, threads, modules, handles) to a minidump that can be loaded with Dumpulator.
+        With incremental=True only the pages that changed since the dump was loaded are written, load the result
+        with Dumpulator(original_dump, overlay=path). Returns the number of bytes of memory written.
+        """
+        with open(path, "wb") as f:
+            return write_minidump(self, f, incremental)
+
+    def profile_dump(self, path: str):
+        """
+        Write the profiling results to a JSON file (requires profile=True).
+        """
+        assert self.profiler is not None, "Profiling is not enabled, pass profile=True"
+        self.profiler.dump(path, self.handles.statistics())
+
+    def _time_slice(self, count: int):
+        # Returns the instruction count for emu_start and whether it is a time slice of the scheduler
+        if count == 0 and self.scheduler.multithreaded:
+            return self.scheduler.time_slice, True
+        return count, False
 
     def stop(self, exit_code=None) -> None:
         try:
@@ -1172,6 +1815,8 @@ rsp in KiUserExceptionDispatcher:
             self.error("Invalid type passed to exit_code!")
         self.stopped = True
         self._uc.emu_stop()
+        if self.trace is not None:
+            self.trace.flush()
 
     def raise_kill(self, exc=None):
         # HACK: You need to use this to exit from hooks (although it might not always work)
@@ -1307,6 +1952,64 @@ rsp in KiUserExceptionDispatcher:
         print(f"status = {hex(status)}")
         return self.read_ptr(image_base_address)
 
+# Results of _probe_precise_exceptions, indexed by whether a block hook is installed
+_precise_exceptions: Dict[bool, FrozenSet[int]] = {}
+
+def _probe_precise_exceptions(block_hook: bool) -> FrozenSet[int]:
+    # Fault in the middle of a translation block and check whether the memory hook sees the faulting instruction
+    # and the register state of the instructions before it. Every kind of fault that _hook_mem handles is probed,
+    # with the same kinds of hooks as the emulator (code hooks on single addresses for HLE and optionally a block
+    # hook for the profiler), because they change how unicorn translates the block.
+    result = _precise_exceptions.get(block_hook, None)
+    if result is not None:
+        return result
+    code_base = 0x10000
+    data_base = 0x200000
+    fault_offset = 8
+    probes = {
+        UC_MEM_READ_UNMAPPED: (bytes.fromhex("8b10"), None),  # mov edx, [eax]
+        UC_MEM_WRITE_UNMAPPED: (bytes.fromhex("8908"), None),  # mov [eax], ecx
+        UC_MEM_READ_PROT: (bytes.fromhex("8b10"), UC_PROT_NONE),
+        UC_MEM_WRITE_PROT: (bytes.fromhex("8908"), UC_PROT_READ),
+    }
+    precise = set()
+    for access, (instruction, data_protect) in probes.items():
+        code = bytes.fromhex(
+            "b901000000"  # mov ecx, 1
+            "83c101"      # add ecx, 1
+        ) + instruction + b"\x90"  # nop
+        fault = {}
+
+        def hook_invalid(uc: Uc, access, address, size, value, user_data):
+            fault["access"] = access
+            fault["pc"] = uc.reg_read(UC_X86_REG_RIP)
+            fault["ecx"] = uc.reg_read(UC_X86_REG_ECX)
+            return False
+
+        try:
+            # Same engine mode as the emulator (x86 code runs in compatibility mode)
+            uc = Uc(UC_ARCH_X86, UC_MODE_64)
+            uc.mem_map(code_base, PAGE_SIZE, UC_PROT_READ | UC_PROT_EXEC)
+            uc.mem_write(code_base, code)
+            if data_protect is not None:
+                uc.mem_map(data_base, PAGE_SIZE, data_protect)
+            uc.reg_write(UC_X86_REG_EAX, data_base)
+            uc.hook_add(UC_HOOK_MEM_INVALID, hook_invalid)
+            uc.hook_add(UC_HOOK_CODE, lambda *args: None, begin=code_base + PAGE_SIZE - 1, end=code_base + PAGE_SIZE - 1)
+            if block_hook:
+                uc.hook_add(UC_HOOK_BLOCK, lambda *args: None)
+            try:
+                uc.emu_start(code_base, code_base + len(code))
+            except UcError:
+                pass
+            if fault.get("access", None) == access and fault["pc"] == code_base + fault_offset and fault["ecx"] == 2:
+                precise.add(access)
+        except Exception:
+            pass
+    result = frozenset(precise)
+    _precise_exceptions[block_hook] = result
+    return result
+
 def _hook_code_exception(uc: Uc, address, size, dp: Dumpulator):
     try:
         dp.info(f"exception step: {hex(address)}[{size}]")
@@ -1319,8 +2022,16 @@ def _hook_code_exception(uc: Uc, address, size, dp: Dumpulator):
         raise err
 
 def _hook_mem(uc: Uc, access, address, size, value, dp: Dumpulator):
+    profile_start = time.perf_counter() if dp.profiler is not None else None
     if dp._pages.handle_lazy_page(address, min(size, PAGE_SIZE)):
         dp.debug(f"committed lazy page {hex(address)}[{hex(size)}] (cip: {hex(dp.regs.cip)})")
+        if profile_start is not None:
+            dp.profiler.add("lazy page", "commit", time.perf_counter() - profile_start)
+        return True
+    if access == UC_MEM_WRITE_PROT and dp._pages.handle_write_fault(address, min(size, PAGE_SIZE)):
+        # First write to a page since the last snapshot
+        if profile_start is not None:
+            dp.profiler.add("write fault", "copy", time.perf_counter() - profile_start)
         return True
 
     fetch_accesses = [UC_MEM_FETCH, UC_MEM_FETCH_PROT, UC_MEM_FETCH_UNMAPPED]
@@ -1349,14 +2060,15 @@ def _hook_mem(uc: Uc, access, address, size, value, dp: Dumpulator):
         exception.memory_size = size
         exception.memory_value = value
         exception.context = uc.context_save()
-        if access not in fetch_accesses:
+        # A precise exception is reported right away, otherwise the block is single stepped to find the instruction
+        final = dp._precise_trace or access in dp._precise_exceptions or dp._exception.code_hook_h is not None
+        if access not in fetch_accesses and not final:
             tb = uc.ctl_request_cache(dp.regs.cip)
             exception.tb_start = tb.pc
             exception.tb_size = tb.size
             exception.tb_icount = tb.icount
 
         # Print exception info
-        final = dp.trace or dp._exception.code_hook_h is not None
         info = "final" if final else "initial"
         if access == UC_MEM_READ_UNMAPPED:
             dp.error(f"{info} unmapped read from {hex(address)}[{hex(size)}], cip = {hex(dp.regs.cip)}, exception: {exception}")
@@ -1381,7 +2093,7 @@ def _hook_mem(uc: Uc, access, address, size, value, dp: Dumpulator):
 
         if final:
             # Make sure this is the same exception we expect
-            if not dp.trace:
+            if dp._exception.code_hook_h is not None:
                 assert violation == dp._exception.memory_violation
                 assert address == dp._exception.memory_address
                 assert size == dp._exception.memory_size
@@ -1448,17 +2160,51 @@ def _get_regs(instr, include_write=False):
                 regs[instr.reg_name(reg)] = None
     return regs
 
+class DecodedInstruction(NamedTuple):
+    size: int
+    mnemonic: str
+    # Mnemonic and operands
+    text: str
+    regs: Tuple[str, ...]
+
+def _decode_instruction(dp: Dumpulator, address: int, size: int):
+    page = address & ~0xFFF
+    page_cache = dp._decode_cache.get(page, None)
+    if page_cache is not None:
+        decoded = page_cache.get(address, None)
+        if decoded is not None and decoded.size == size:
+            return decoded, b""
+
+    code = b""
+    try:
+        code = dp.read(address, min(size, 15))
+        instr = next(dp.cs.disasm(code, address, 1))
+    except StopIteration:
+        return None, code  # Unsupported instruction
+    except IndexError:
+        return None, code  # Likely invalid memory
+
+    text = instr.mnemonic
+    if instr.op_str:
+        text += " "
+        text += instr.op_str
+    decoded = DecodedInstruction(instr.size, instr.mnemonic, text, tuple(_get_regs(instr)))
+    # Only code in executable pages is cached, writes to those pages invalidate the cache
+    lazy_page = dp._pages.pages.get(page, None)
+    if lazy_page is not None and lazy_page.protect.executable:
+        if page_cache is None:
+            page_cache = dp._cache_decoded_page(page)
+        page_cache[address] = decoded
+    return decoded, code
+
+def _hook_mem_write(uc: Uc, access, address, size, value, dp: Dumpulator):
+    # Only installed on the pages in the decode cache (see Dumpulator._cache_decoded_page)
+    dp._invalidate_decode_cache(address, size)
+
 def _hook_code(uc: Uc, address, size, dp: Dumpulator):
     try:
         uc.ctl_remove_cache(address, address + 16)
-        code = b""
-        try:
-            code = dp.read(address, min(size, 15))
-            instr = next(dp.cs.disasm(code, address, 1))
-        except StopIteration:
-            instr = None  # Unsupported instruction
-        except IndexError:
-            instr = None  # Likely invalid memory
+        instr, code = _decode_instruction(dp, address, size)
         address_name = dp.exports.get(address, "")
 
         module = ""
@@ -1478,11 +2224,8 @@ def _hook_code(uc: Uc, address, size, dp: Dumpulator):
 
         line = f"{hex(address)}{address_name}|"
         if instr is not None:
-            line += instr.mnemonic
-            if instr.op_str:
-                line += " "
-                line += instr.op_str
-            for reg in _get_regs(instr):
+            line += instr.text
+            for reg in instr.regs:
                 line += f"|{reg}={hex(dp.regs.__getattr__(reg))}"
             if instr.mnemonic == "call":
                 # print return address
@@ -1498,6 +2241,62 @@ def _hook_code(uc: Uc, address, size, dp: Dumpulator):
         dp.stop()
         raise e
 
+def _hook_block(uc: Uc, address, size, dp: Dumpulator):
+    try:
+        writer: BlockTraceWriter = dp.trace
+        block = writer.blocks.get(address, None)
+        if block is None or block.size != size:
+            try:
+                icount = uc.ctl_request_cache(address).icount
+            except UcError:
+                icount = 0
+            module = dp.modules.find(address)
+            writer.block(address, size, icount, module.name if module is not None else "-")
+        writer.hit(address)
+    except (KeyboardInterrupt, SystemExit) as e:
+        dp.stop()
+        raise e
+
+def _hook_profile_block(uc: Uc, address, size, dp: Dumpulator):
+    def module_name(address):
+        module = dp.modules.find(address)
+        return module.name if module is not None else "-"
+
+    def instruction_count(address):
+        try:
+            return uc.ctl_request_cache(address).icount
+        except UcError:
+            return 0
+
+    try:
+        dp.profiler.block(address, module_name, instruction_count)
+    except (KeyboardInterrupt, SystemExit) as e:
+        dp.stop()
+        raise e
+
+def _hook_code_binary(uc: Uc, address, size, dp: Dumpulator):
+    try:
+        writer: BinaryTraceWriter = dp.trace
+        # NOTE: unlike _hook_code the translation cache is kept, the instruction bytes are stored in the trace
+        try:
+            code = bytes(uc.mem_read(address, min(size, 15)))
+        except UcError:
+            code = b""
+
+        if not (dp.last_module and address in dp.last_module):
+            dp.last_module = dp.modules.find(address)
+        module_id = writer.module_id(dp.last_module)
+
+        address_name = dp.exports.get(address, None)
+        if address_name is not None:
+            writer.symbol(address, address_name)
+
+        values = dp.regs.read_batch(writer.register_ids)
+        writer.instruction(address, code, module_id, dp.sequence_id, values)
+    except (KeyboardInterrupt, SystemExit) as e:
+        dp.stop()
+        raise e
+
 def _unicode_string_to_string(dp: Dumpulator, arg: P[UNICODE_STRING]):
     try:
         return arg[0].read_str()
@@ -1547,6 +2346,68 @@ def _arg_type_string(arg):
         return arg.type.__name__ + "*"
     return type(arg).__name__
 
+class HleFunction(NamedTuple):
+    name: str
+    callback: Callable[..., Optional[int]]
+    argcount: int
+    # Only relevant for x86, the callee pops the arguments
+    stdcall: bool
+
+def _hook_hle(uc: Uc, address, size, user_data):
+    dp, function = user_data
+    try:
+        args = [dp.args[i] for i in range(function.argcount)]
+        result = function.callback(dp, *args)
+        # None means the guest implementation has to handle this call (for example to raise an exception)
+        if result is None:
+            return
+        dp.regs.cax = result & dp.addr_mask
+        imm = function.argcount * 4 if function.stdcall and not dp._x64 else 0
+        dp.regs.cip = dp.ret(imm)
+    except (KeyboardInterrupt, SystemExit) as e:
+        dp.stop()
+        raise e
+
+class SyscallArgument(NamedTuple):
+    name: str
+    sal_pretty: str
+    convert: Callable[[Dumpulator, int], Any]
+
+def _compile_syscall(syscall_impl) -> Tuple[SyscallArgument, ...]:
+    # Resolve the annotations of the implementation once instead of on every call
+    argspec = inspect.getfullargspec(syscall_impl)
+    arguments = []
+    for argname in argspec.args[1:]:
+        argtype = argspec.annotations[argname]
+        # Extract the type information from the annotation
+        # Reference: https://github.com/python/cpython/issues/89543
+        # It looks like the python designers did an oopsie, so we're going
+        # the fully-undocumented route.
+        sal = None
+        if "Annotated" in type(argtype).__name__:
+            sal, = argtype.__metadata__
+            argtype = argtype.__origin__
+
+        if sal is None:
+            sal_pretty = ""
+        else:
+            sal_pretty = str(sal) + " "
+
+        if P.is_ptr(argtype):
+            def convert(dp: Dumpulator, argvalue: int, argtype=argtype):
+                return argtype(dp, argvalue)
+        elif issubclass(argtype, Enum):
+            def convert(dp: Dumpulator, argvalue: int, argtype=argtype):
+                try:
+                    return argtype(argvalue & 0xFFFFFFFF)
+                except KeyError as x:
+                    raise Exception(f"Unknown enum value {argvalue} for {type(argtype)}") from None
+        else:
+            def convert(dp: Dumpulator, argvalue: int, argtype=argtype):
+                return argtype(argvalue)
+        arguments.append(SyscallArgument(argname, sal_pretty, convert))
+    return tuple(arguments)
+
 def _hook_interrupt(uc: Uc, number, dp: Dumpulator):
     if dp.trace:
         dp.trace.flush()
@@ -1587,6 +2448,18 @@ def _hook_interrupt(uc: Uc, number, dp: Dumpulator):
     # Stop emulation (we resume it on KiUserExceptionDispatcher later)
     raise UcError(UC_ERR_EXCEPTION)
 
+def _hook_thread_exit(uc: Uc, address, size, dp: Dumpulator):
+    # The jmp $ can be executed again before the emulation stops
+    if dp._exception.type != ExceptionType.NoException:
+        return
+    exit_status = dp.regs.cax
+    dp.info(f"thread {dp.thread_id} exited with {hex(exit_status)}")
+    try:
+        dp._exception = dp.scheduler.terminate(dp.scheduler.current.obj, exit_status)
+    except Exception as exc:
+        raise dp.raise_kill(exc) from None
+    raise UcError(UC_ERR_EXCEPTION)
+
 def _hook_syscall(uc: Uc, dp: Dumpulator):
     # Flush the trace for easier debugging
     if dp.trace is not None:
@@ -1607,9 +2480,10 @@ def _hook_syscall(uc: Uc, dp: Dumpulator):
         table_prefix = f"unknown:{table_number} "
 
     if function_index < len(table):
-        name, syscall_impl, argcount = table[function_index]
+        name, syscall_impl, arguments = table[function_index]
         if syscall_impl:
-            argspec = inspect.getfullargspec(syscall_impl)
+            profile_start = time.perf_counter() if dp.profiler is not None else None
+            argcount = len(arguments)
             args = []
 
             def syscall_arg(index):
@@ -1620,42 +2494,19 @@ def _hook_syscall(uc: Uc, dp: Dumpulator):
                     return dp.regs.r10
                 return dp.args[index]
 
-            dp.info(f"[{dp.sequence_id}] {table_prefix}syscall: {name}( /* index: {hex(service_number)} */")
-            for i in range(0, argcount):
-                argname = argspec.args[1 + i]
-                argtype = argspec.annotations[argname]
-                # Extract the type information from the annotation
-                # Reference: https://github.com/python/cpython/issues/89543
-                # It looks like the python designers did an oopsie, so we're going
-                # the fully-undocumented route.
-                sal = None
-                if "Annotated" in type(argtype).__name__:
-                    sal, = argtype.__metadata__
-                    argtype = argtype.__origin__
-
-                if sal is None:
-                    sal_pretty = ""
-                else:
-                    sal_pretty = str(sal) + " "
+            for i, argument in enumerate(arguments):
+                args.append(argument.convert(dp, syscall_arg(i)))
 
-                argvalue = syscall_arg(i)
-                if P.is_ptr(argtype):
-                    argvalue = argtype(dp, argvalue)
-                elif issubclass(argtype, Enum):
-                    try:
-                        argvalue = argtype(argvalue & 0xFFFFFFFF)
-                    except KeyError as x:
-                        raise Exception(f"Unknown enum value {argvalue} for {type(argtype)}") from None
-                else:
-                    argvalue = argtype(argvalue)
-                args.append(argvalue)
+            # Formatting the arguments is expensive, only do it when logging is enabled
+            if not dp._quiet:
+                dp.info(f"[{dp.sequence_id}] {table_prefix}syscall: {name}( /* index: {hex(service_number)} */")
+                for i, (argument, argvalue) in enumerate(zip(arguments, args)):
+                    comma = ","
+                    if i + 1 == argcount:
+                        comma = ""
 
-                comma = ","
-                if i + 1 == argcount:
-                    comma = ""
-
-                dp.info(f"    {sal_pretty}{_arg_type_string(argvalue)} {argname} = {_arg_to_string(dp, argvalue)}{comma}")
-            dp.info(")")
+                    dp.info(f"    {argument.sal_pretty}{_arg_type_string(argvalue)} {argument.name} = {_arg_to_string(dp, argvalue)}{comma}")
+                dp.info(")")
             try:
                 status = syscall_impl(dp, *args)
                 if isinstance(status, ExceptionInfo):
@@ -1678,60 +2529,72 @@ def _hook_syscall(uc: Uc, dp: Dumpulator):
                 raise dp.raise_kill(exc) from None
             finally:
                 dp.sequence_id += 1
+                if profile_start is not None:
+                    dp.profiler.add("syscall", table_prefix + name, time.perf_counter() - profile_start)
         else:
             raise dp.raise_kill(NotImplementedError(f"{table_prefix}syscall {hex(service_number)} -> {name} not implemented!")) from None
     else:
         raise dp.raise_kill(IndexError(f"{table_prefix}syscall {hex(service_number)} (index: {hex(function_index)}) out of range")) from None
 
-def _emulate_unsupported_instruction(dp: Dumpulator, instr: CsInsn):
+class CompiledInstruction(NamedTuple):
+    # Bytes of the instruction, to detect modified code
+    code: bytes
+    run: Callable[[], None]
+
+def _compile_unsupported_instruction(dp: Dumpulator, instr: CsInsn) -> Optional[Callable[[], None]]:
+    """
+    Translate an instruction unicorn cannot emulate to a function that emulates it. The operands are resolved to
+    unicorn register ids and address computations once, so running the instruction again skips the decoding.
+    """
+    uc = dp._uc
     # Get address mask
     if dp.regs.cs == windows_user_segment.cs:
         address_mask = 0xFFFFFFFFFFFFFFFF
     else:
         address_mask = 0xFFFFFFFF
 
-    def op_mem(op: X86Op, *, aligned: bool):
-        mem_address = 0
-        if op.mem.base == X86_REG_RIP:
-            mem_address += instr.address + instr.size
-        else:
-            base = op.mem.base
-            if base != X86_REG_INVALID:
-                name = instr.reg_name(base)
-                value = dp.regs[name]
-                mem_address += value
-
-            index = op.mem.index
-            if index != X86_REG_INVALID:
-                name = instr.reg_name(index)
-                value = dp.regs[name]
-                mem_address += value * op.mem.scale
+    def reg_id(reg: int) -> int:
+        return dp.regs._resolve_reg(instr.reg_name(reg))
 
+    def op_mem(op: X86Op, *, aligned: bool) -> Callable[[], int]:
         disp = op.mem.disp # TODO: negative value handling?
-        mem_address += disp
-        mem_address &= address_mask
-        if aligned:
-            alignment = op.size
+        if op.mem.base == X86_REG_RIP:
+            mem_address = (instr.address + instr.size + disp) & address_mask
+            return lambda: mem_address
+        base = reg_id(op.mem.base) if op.mem.base != X86_REG_INVALID else None
+        index = reg_id(op.mem.index) if op.mem.index != X86_REG_INVALID else None
+        scale = op.mem.scale
+        alignment = op.size if aligned else 1
+
+        def address():
+            mem_address = disp
+            if base is not None:
+                mem_address += uc.reg_read(base)
+            if index is not None:
+                mem_address += uc.reg_read(index) * scale
+            mem_address &= address_mask
             if mem_address & (alignment - 1) != 0:
                 assert False, f"Address {hex(mem_address)} not aligned to {alignment}"
-        return mem_address
+            return mem_address
+        return address
 
-    def op_read(index: int, *, aligned=False):
+    def op_read(index: int, *, aligned=False) -> Callable[[], int]:
         op: X86Op = instr.operands[index]
         if op.type == CS_OP_REG:
-            name = instr.reg_name(op.value.reg)
-            return dp.regs[name]
+            reg = reg_id(op.value.reg)
+            return lambda: uc.reg_read(reg)
         elif op.type == CS_OP_MEM:
-            mem_address = op_mem(op, aligned=aligned)
-            data = dp.read(mem_address, op.size)
-            return int.from_bytes(data, "little")
+            address = op_mem(op, aligned=aligned)
+            size = op.size
+            return lambda: int.from_bytes(dp.read(address(), size), "little")
         elif op.type == CS_OP_IMM:
             # TODO: sign extend?
-            return op.value.imm
+            imm = op.value.imm
+            return lambda: imm
         else:
             raise NotImplementedError()
 
-    def op_write(index: int, value: int, *, aligned=False):
+    def op_write(index: int, *, aligned=False) -> Callable[[int], None]:
         op: X86Op = instr.operands[index]
         size = op.size
         if op.type == CS_OP_REG:
@@ -1740,67 +2603,73 @@ def _emulate_unsupported_instruction(dp: Dumpulator, instr: CsInsn):
                 # Extend the register
                 assert name[0] == "e"
                 name = "r" + name[1:]
-            dp.regs[name] = value
+            reg = dp.regs._resolve_reg(name)
+            return lambda value: uc.reg_write(reg, value)
         elif op.type == CS_OP_MEM:
-            mem_address = op_mem(op, aligned=aligned)
-            data = value.to_bytes(size, "little")
+            address = op_mem(op, aligned=aligned)
             # TODO: handle invalid memory access
-            dp.write(mem_address, data)
+            return lambda value: dp.write(address(), value.to_bytes(size, "little"))
         else:
             raise NotImplementedError()
 
     def op_bits(index: int):
         return instr.operands[index].size * 8
 
-    def cip_next():
-        dp.regs.cip += instr.size
+    cip = dp.regs._resolve_reg("cip")
+    cip_next = instr.address + instr.size
 
     if instr.id == X86_INS_RDRAND:
-        # TODO: PRNG based on dmp hash
-        op_write(0, 42)
-        cip_next()
+        dst = op_write(0)
+        def emulate():
+            # TODO: PRNG based on dmp hash
+            dst(42)
     elif instr.id == X86_INS_RDTSCP:
-        # TODO: properly implement
-        dp.regs.rdx = 0
-        dp.regs.rax = 0
-        dp.regs.rcx = 0
-        cip_next()
+        def emulate():
+            # TODO: properly implement
+            uc.reg_write(UC_X86_REG_RDX, 0)
+            uc.reg_write(UC_X86_REG_RAX, 0)
+            uc.reg_write(UC_X86_REG_RCX, 0)
     elif instr.id == X86_INS_RDGSBASE:
-        op_write(0, dp.regs.gs_base)
-        cip_next()
+        dst = op_write(0)
+        def emulate():
+            dst(uc.reg_read(UC_X86_REG_GS_BASE))
     elif instr.id in [X86_INS_VMOVDQU, X86_INS_VMOVUPS]:
-        src = op_read(1)
-        op_write(0, src)
-        cip_next()
+        src, dst = op_read(1), op_write(0)
+        def emulate():
+            dst(src())
     elif instr.id in [X86_INS_VMOVDQA, X86_INS_MOVNTDQ, X86_INS_VMOVAPS]:
-        src = op_read(1, aligned=True)
-        op_write(0, src, aligned=True)
-        cip_next()
+        src, dst = op_read(1, aligned=True), op_write(0, aligned=True)
+        def emulate():
+            dst(src())
     elif instr.id == X86_INS_VINSERTF128:
-        src = op_read(1)
-        xmm1 = op_read(2)
-        imm8 = op_read(3)
-        if imm8 == 0:
-            src = (src & 0xffffffffffffffffffffffffffffffff00000000000000000000000000000000) | xmm1
-        elif imm8 == 1:
-            src = (src & 0x00000000000000000000000000000000ffffffffffffffffffffffffffffffff) | (xmm1 << 128)
-        op_write(0, src)
-        cip_next()
+        src, xmm, imm8, dst = op_read(1), op_read(2), op_read(3)(), op_write(0)
+        def emulate():
+            value = src()
+            if imm8 == 0:
+                value = (value & 0xffffffffffffffffffffffffffffffff00000000000000000000000000000000) | xmm()
+            elif imm8 == 1:
+                value = (value & 0x00000000000000000000000000000000ffffffffffffffffffffffffffffffff) | (xmm() << 128)
+            dst(value)
     elif instr.id == X86_INS_VPBROADCASTQ:
-        src = op_read(1) & 0xFFFFFFFFFFFFFFFF
-        result = 0
-        for _ in range(op_bits(0) // 64):
-            result <<= 64
-            result |= src
-        op_write(0, result)
-        cip_next()
+        src, dst = op_read(1), op_write(0)
+        count = op_bits(0) // 64
+        def emulate():
+            value = src() & 0xFFFFFFFFFFFFFFFF
+            result = 0
+            for _ in range(count):
+                result <<= 64
+                result |= value
+            dst(result)
     else:
         dp.error(f"unsupported: {hex(instr.address)}|{instr.mnemonic} {instr.op_str}")
         # Unsupported instruction
-        return False
-    dp.debug(f"emulated: {hex(instr.address)}|{instr.bytes.hex()}|{instr.mnemonic} {instr.op_str}")
-    # Resume execution
-    return True
+        return None
+
+    def run():
+        emulate()
+        uc.reg_write(cip, cip_next)
+    dp.debug(f"compiled: {hex(instr.address)}|{instr.bytes.hex()}|{instr.mnemonic} {instr.op_str}")
+    return run
 
 def _hook_invalid(uc: Uc, dp: Dumpulator):
     address = dp.regs.cip
@@ -1811,11 +2680,19 @@ def _hook_invalid(uc: Uc, dp: Dumpulator):
         dp.error(f"terminating emulation...")
         return False
     try:
-        code = dp.read(address, 15)
-        instr = next(dp.cs.disasm(code, address, 1))
-        dp.debug(f"invalid hook {hex(address)}|{code.hex()}|{instr.mnemonic} {instr.op_str}")
+        # The instruction is only decoded the first time it executes
+        compiled = dp._unsupported_cache.get(address, None)
+        if compiled is None or dp.read(address, len(compiled.code)) != compiled.code:
+            code = dp.read(address, 15)
+            instr = next(dp.cs.disasm(code, address, 1))
+            dp.debug(f"invalid hook {hex(address)}|{code.hex()}|{instr.mnemonic} {instr.op_str}")
+            run = _compile_unsupported_instruction(dp, instr)
+            compiled = CompiledInstruction(bytes(instr.bytes), run) if run is not None else None
+            if compiled is not None:
+                dp._unsupported_cache[address] = compiled
         # TODO: add a hook
-        if _emulate_unsupported_instruction(dp, instr):
+        if compiled is not None:
+            compiled.run()
             # Resume execution with a context switch
             assert dp._exception.type == ExceptionType.NoException
             exception = UnicornExceptionInfo()
@@ -0,0 +1,254 @@
+import bisect
+import struct
+from typing import BinaryIO, Iterator, List, Optional, Tuple, TYPE_CHECKING
+
+from .details import Registers
+from .handles import AbstractFileObject, EventObject, RegistryKeyObject
+from .memory import MemoryState, PAGE_SIZE
+from .native import CONTEXT, CONTEXT_ALL, WOW64_CONTEXT
+
+if TYPE_CHECKING:
+    from .dumpulator import Dumpulator
+
+# https://learn.microsoft.com/en-us/windows/win32/api/minidumpapiset/ne-minidumpapiset-minidump_stream_type
+ThreadListStream = 3
+ModuleListStream = 4
+SystemInfoStream = 7
+Memory64ListStream = 9
+HandleDataStream = 12
+MiscInfoStream = 15
+MemoryInfoListStream = 16
+
+MINIDUMP_SIGNATURE = 0x504D444D
+MINIDUMP_VERSION = 0xA793
+MiniDumpWithFullMemory = 0x2
+MiniDumpWithHandleData = 0x4
+MiniDumpWithFullMemoryInfo = 0x800
+
+# WOW64_CONTEXT_i386 | CONTROL | INTEGER | SEGMENTS | FLOATING_POINT | DEBUG_REGISTERS | EXTENDED_REGISTERS
+WOW64_CONTEXT_ALL = 0x1003F
+
+# Pages read from the emulator at once while streaming the memory
+CHUNK_PAGES = 256
+_ZERO_PAGE = bytes(PAGE_SIZE)
+
+class _StreamData:
+    # Contents of the streams and the data they reference, the offsets are RVAs in the file
+    def __init__(self, base_rva: int):
+        self.base_rva = base_rva
+        self.data = bytearray()
+
+    @property
+    def rva(self) -> int:
+        return self.base_rva + len(self.data)
+
+    def add(self, data: bytes) -> int:
+        # Returns the RVA of the data, aligned to 8 bytes
+        self.data += bytes(-len(self.data) % 8)
+        rva = self.rva
+        self.data += data
+        return rva
+
+    def string(self, s: str) -> int:
+        # MINIDUMP_STRING
+        data = s.encode("utf-16-le")
+        return self.add(struct.pack("<I", len(data)) + data + b"\0\0")
+
+def _thread_context(dp: "Dumpulator", regs: Registers) -> bytes:
+    if dp.x64:
+        context = CONTEXT()
+        context.ContextFlags = CONTEXT_ALL
+    else:
+        context = WOW64_CONTEXT()
+        context.ContextFlags = WOW64_CONTEXT_ALL
+    context.from_regs(regs)
+    return bytes(context)
+
+def _threads(dp: "Dumpulator") -> List[Tuple[int, int, bytes]]:
+    # (thread id, TEB, context) of the threads that did not exit, the current thread first
+    scheduler = dp.scheduler
+    threads = [(scheduler.current.thread_id, scheduler.current.teb, _thread_context(dp, dp.regs))]
+    for thread in scheduler.threads.values():
+        if thread is scheduler.current or thread.context is None:
+            continue
+        # The saved unicorn context has the same register interface as the emulator
+        regs = Registers(thread.context, dp.x64)
+        threads.append((thread.thread_id, thread.teb, _thread_context(dp, regs)))
+    return threads
+
+def _handle_names(handle_data) -> Tuple[str, Optional[str]]:
+    # Type and object names recognized by Dumpulator._setup_handles
+    if isinstance(handle_data, AbstractFileObject):
+        return "File", handle_data.path
+    if isinstance(handle_data, RegistryKeyObject):
+        return "Key", handle_data.key
+    if isinstance(handle_data, EventObject):
+        return "Event", None
+    return type(handle_data).__name__, None
+
+def _system_info(dp: "Dumpulator", streams: _StreamData) -> bytes:
+    # The version is taken from KUSER_SHARED_DATA
+    try:
+        build = dp.read_ulong(0x7ffe0000 + 0x260) & 0xFFFF
+        major = dp.read_ulong(0x7ffe0000 + 0x26c)
+        minor = dp.read_ulong(0x7ffe0000 + 0x270)
+    except IndexError:
+        build, major, minor = 0, 10, 0
+    architecture = 9 if dp.x64 else 0  # PROCESSOR_ARCHITECTURE_AMD64, PROCESSOR_ARCHITECTURE_INTEL
+    csd_version = streams.string("")
+    # VER_NT_WORKSTATION, VER_PLATFORM_WIN32_NT
+    return struct.pack("<HHHBBIIIIIHH24s", architecture, 6, 0, 1, 1, major, minor, build, 2, csd_version, 0, 0, b"")
+
+class _OriginalPages:
+    # Contents of the pages in the segments of the dump the emulator was loaded from
+    def __init__(self, dp: "Dumpulator"):
+        self.backing = dp._pages.backing
+        self.segments = sorted(dp._prepared.segments)
+        self.starts = [virtual_address for virtual_address, _, _ in self.segments]
+
+    def __getitem__(self, page_addr: int) -> Optional[bytes]:
+        # None when the page was not in the dump (the emulator initialized it with zeroes)
+        index = bisect.bisect_right(self.starts, page_addr) - 1
+        if index < 0:
+            return None
+        virtual_address, size, file_offset = self.segments[index]
+        if page_addr + PAGE_SIZE > virtual_address + size:
+            return None
+        offset = file_offset + page_addr - virtual_address
+        return self.backing[offset:offset + PAGE_SIZE]
+
+def _runs(page_addrs: Iterator[int]) -> Iterator[Tuple[int, int]]:
+    # Merge the (sorted) pages into (address, size) ranges
+    run_start = None
+    run_end = None
+    for page_addr in page_addrs:
+        if page_addr != run_end:
+            if run_start is not None:
+                yield run_start, run_end - run_start
+            run_start = page_addr
+        run_end = page_addr + PAGE_SIZE
+    if run_start is not None:
+        yield run_start, run_end - run_start
+
+def _committed_chunks(dp: "Dumpulator") -> Iterator[Tuple[int, int]]:
+    # (address, size) of the committed memory in chunks of at most CHUNK_PAGES pages
+    for info in dp.memory.map():
+        if info.state != MemoryState.MEM_COMMIT:
+            continue
+        end = info.base + info.region_size
+        for addr in range(info.base, end, CHUNK_PAGES * PAGE_SIZE):
+            yield addr, min(CHUNK_PAGES * PAGE_SIZE, end - addr)
+
+def _memory_pages(dp: "Dumpulator", incremental: bool) -> Iterator[int]:
+    # Pages written to the dump: the committed pages that are not all zeroes (as far as is known without reading
+    # them), or only the pages that are different from the original dump
+    pages = dp._pages.pages
+    original = _OriginalPages(dp) if incremental else None
+    for addr, size in _committed_chunks(dp):
+        data = None
+        for page_addr in range(addr, addr + size, PAGE_SIZE):
+            page = pages[page_addr]
+            if not page.committed and page.data is None:
+                # Untouched lazy page: never written by the guest, or all zeroes
+                if page.file_offset is not None and not incremental:
+                    yield page_addr
+                continue
+            if original is None:
+                yield page_addr
+                continue
+            if data is None:
+                data = dp._pages.read(addr, size)
+            index = page_addr - addr
+            current = data[index:index + PAGE_SIZE]
+            initial = original[page_addr]
+            if current != (_ZERO_PAGE if initial is None else initial):
+                yield page_addr
+
+def write_minidump(dp: "Dumpulator", f: BinaryIO, incremental=False) -> int:
+    """
+    Write the state of the emulator as a minidump: the memory map, the committed memory, the threads (with their
+    current context), the modules and the handles. The stream metadata is built in memory, the page contents are
+    streamed to the file in chunks after it.
+
+    With incremental=True only the pages that differ from the original dump are written. The result is an overlay
+    that can be loaded on top of the original dump with Dumpulator(original, overlay=path).
+    Returns the number of bytes of memory written.
+    """
+    if incremental and dp._pages.backing is None:
+        raise ValueError("Incremental dumps require a dump that is mapped from a file")
+
+    stream_types = [ThreadListStream, ModuleListStream, MemoryInfoListStream, SystemInfoStream, MiscInfoStream, HandleDataStream, Memory64ListStream]
+    directory_rva = 32
+    streams = _StreamData(directory_rva + len(stream_types) * 12)
+    directory = {}
+
+    threads = _threads(dp)
+    thread_list = bytearray(struct.pack("<I", len(threads)))
+    for thread_id, teb, context in threads:
+        context_rva = streams.add(context)
+        # MINIDUMP_THREAD, the stack is in the memory list
+        thread_list += struct.pack("<IIIIQQIIII", thread_id, 0, 0x20, 0, teb, 0, 0, 0, len(context), context_rva)
+    directory[ThreadListStream] = thread_list
+
+    modules = list(dp.modules)
+    module_list = bytearray(struct.pack("<I", len(modules)))
+    for module in modules:
+        key = dp._module_image_key(module.base)
+        timestamp = key[0] if key is not None else 0
+        name_rva = streams.string(module.path)
+        # MINIDUMP_MODULE, without version information, CodeView and misc records
+        module_list += struct.pack("<QIIII52s8s8sQQ", module.base, module.size, 0, timestamp, name_rva, b"", b"", b"", 0, 0)
+    directory[ModuleListStream] = module_list
+
+    memory_map = dp.memory.map()
+    memory_info = bytearray(struct.pack("<IIQ", 16, 48, len(memory_map)))
+    for info in memory_map:
+        protect = info.protect.value if info.protect is not None else 0
+        memory_type = info.type.value if info.type is not None else 0
+        memory_info += struct.pack("<QQIIQIIII", info.base, info.allocation_base, info.allocation_protect.value, 0,
+                                   info.region_size, info.state.value, protect, memory_type, 0)
+    directory[MemoryInfoListStream] = memory_info
+
+    directory[SystemInfoStream] = _system_info(dp, streams)
+    # MINIDUMP_MISC_INFO with MINIDUMP_MISC1_PROCESS_ID
+    directory[MiscInfoStream] = struct.pack("<IIIIII", 24, 1, dp.process_id, 0, 0, 0)
+
+    handles = list(dp.handles)
+    handle_data = bytearray(struct.pack("<IIII", 16, 32, len(handles), 0))
+    for handle_value, handle_object in handles:
+        type_name, object_name = _handle_names(handle_object)
+        type_rva = streams.string(type_name)
+        name_rva = streams.string(object_name) if object_name is not None else 0
+        handle_data += struct.pack("<QIIIIII", handle_value, type_rva, name_rva, 0, 0, 1, 1)
+    directory[HandleDataStream] = handle_data
+
+    ranges = list(_runs(_memory_pages(dp, incremental)))
+    memory_list_size = 16 + 16 * len(ranges)
+    stream_locations = []
+    for stream_type in stream_types:
+        if stream_type == Memory64ListStream:
+            # This is the last stream, the memory directly follows the descriptors
+            rva = streams.add(b"")
+            memory_list = bytearray(struct.pack("<QQ", len(ranges), rva + memory_list_size))
+            for addr, size in ranges:
+                memory_list += struct.pack("<QQ", addr, size)
+            streams.data += memory_list
+            stream_locations.append((stream_type, memory_list_size, rva))
+        else:
+            data = directory[stream_type]
+            stream_locations.append((stream_type, len(data), streams.add(data)))
+
+    flags = MiniDumpWithFullMemory | MiniDumpWithHandleData | MiniDumpWithFullMemoryInfo
+    f.write(struct.pack("<IIIIIIQ", MINIDUMP_SIGNATURE, MINIDUMP_VERSION, len(stream_types), directory_rva, 0, 0, flags))
+    for stream_type, size, rva in stream_locations:
+        f.write(struct.pack("<III", stream_type, size, rva))
+    f.write(streams.data)
+
+    total = 0
+    read = dp._pages.read
+    for addr, size in ranges:
+        for chunk_addr in range(addr, addr + size, CHUNK_PAGES * PAGE_SIZE):
+            chunk_size = min(CHUNK_PAGES * PAGE_SIZE, addr + size - chunk_addr)
+            f.write(read(chunk_addr, chunk_size))
+            total += chunk_size
+    return total
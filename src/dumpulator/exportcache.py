@@ -0,0 +1,72 @@
+import hashlib
+import json
+import os
+from pathlib import Path
+from typing import List, Optional
+
+import pefile
+from minidump.utils.workers import process_pool
+from .modules import ModuleTable
+
+# Bump when the ModuleTable format changes
+CACHE_VERSION = 1
+# Minimum number of cache misses to parse in worker processes (see process_pool)
+PARALLEL_THRESHOLD = 8
+
+def default_cache_directory() -> Path:
+    directory = os.environ.get("DUMPULATOR_CACHE", None)
+    if directory:
+        return Path(directory)
+    return Path.home() / ".cache" / "dumpulator" / "exports"
+
+def parse_image(data: bytes) -> Optional[ModuleTable]:
+    # Parse a module that was dumped from memory (the sections are at their virtual addresses)
+    try:
+        pe = pefile.PE(data=data, fast_load=True)
+    except pefile.PEFormatError:
+        return None
+    for section in pe.sections:
+        section.PointerToRawData = section.VirtualAddress
+        section.PointerToRawData_adj = section.VirtualAddress
+    return ModuleTable.from_pe(pe)
+
+class ExportCache:
+    """
+    On-disk cache of the parsed headers of the modules in a dump. The entries are keyed by the module path, the
+    TimeDateStamp and the SizeOfImage, so they can be shared between dumps from the same Windows build.
+    """
+    def __init__(self, directory: Optional[Path] = None):
+        self.directory = default_cache_directory() if directory is None else Path(directory)
+
+    def _entry_path(self, path: str, timestamp: int, size_of_image: int) -> Path:
+        key = f"{CACHE_VERSION}|{path.lower()}|{timestamp:08x}|{size_of_image:x}"
+        return self.directory / (hashlib.sha1(key.encode()).hexdigest() + ".json")
+
+    def load(self, path: str, timestamp: int, size_of_image: int) -> Optional[ModuleTable]:
+        try:
+            with open(self._entry_path(path, timestamp, size_of_image), "r") as f:
+                return ModuleTable.from_json(json.load(f))
+        except (OSError, ValueError, KeyError, TypeError):
+            return None
+
+    def store(self, path: str, timestamp: int, size_of_image: int, table: ModuleTable):
+        entry_path = self._entry_path(path, timestamp, size_of_image)
+        try:
+            self.directory.mkdir(parents=True, exist_ok=True)
+            # Write to a temporary file first, concurrent instances might be reading the entry
+            temp_path = entry_path.with_suffix(f".{os.getpid()}.tmp")
+            with open(temp_path, "w") as f:
+                json.dump(table.to_json(), f)
+            os.replace(temp_path, entry_path)
+        except OSError:
+            pass
+
+def parse_images(images: List[bytes], parallel=False) -> List[Optional[ModuleTable]]:
+    """
+    Parse the images in-process, or in worker processes with parallel=True. Spawned workers (the default on Windows
+    and macOS) import the __main__ module, so the main script needs an `if __name__ == "__main__":` guard then.
+    """
+    if parallel and len(images) >= PARALLEL_THRESHOLD and (os.cpu_count() or 1) > 1:
+        with process_pool(spawn=True) as executor:
+            return list(executor.map(parse_image, images))
+    return [parse_image(data) for data in images]
@@ -1,8 +1,12 @@
-from typing import Any, Dict, Optional, Type, TypeVar, List
+import mmap
+import os
+from typing import Any, Deque, Dict, Optional, Set, Type, TypeVar, List
+from collections import deque
 from pathlib import Path
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 
 from .native import *
+from .registry import RegistryHive, RegistryKey
 
 T = TypeVar('T')
 
@@ -38,20 +42,48 @@ class UnsupportedObject(AbstractObject):
 class AbstractFileObject(AbstractObject):
     path: str
 
+    @property
+    def size(self) -> int:
+        return 0
+
     def read(self, size: Optional[int] = None) -> bytes:
         raise NotImplementedError()
 
     def write(self, buffer: bytes, size: Optional[int] = None):
         raise NotImplementedError()
 
+    def read_into(self, dp: "Dumpulator", address: int, size: int) -> int:
+        """
+        Read size bytes from the file straight into the guest memory at address, returns the number of bytes read.
+        """
+        data = self.read(size)
+        dp.write(address, data)
+        return len(data)
+
 @dataclass
 class FileObject(AbstractFileObject):
-    data: Optional[bytes] = None
+    data: Optional[bytearray] = None
     file_offset: int = 0
+    # The data is shared with a snapshot copy, it is copied before the first write
+    _shared: bool = field(default=False, repr=False, compare=False)
+
+    def __post_init__(self):
+        if self.data is not None and not isinstance(self.data, bytearray):
+            self.data = bytearray(self.data)
 
     def __str__(self):
         return self.pretty("path", "file_offset")
 
+    def __deepcopy__(self, memo):
+        self._shared = True
+        copy = FileObject(self.path, self.data, self.file_offset, True)
+        memo[id(self)] = copy
+        return copy
+
+    @property
+    def size(self) -> int:
+        return 0 if self.data is None else len(self.data)
+
     def read(self, size: Optional[int] = None) -> bytes:
         # TODO: store file access flags to handle access violations
 
@@ -60,10 +92,9 @@ class FileObject(AbstractFileObject):
 
         if size is None:
             data = self.data[self.file_offset:]
-            self.file_offset += len(data)
         else:
             data = self.data[self.file_offset:self.file_offset+size]
-            self.file_offset += len(data)
+        self.file_offset += len(data)
         return bytes(data)
 
     def write(self, buffer: bytes, size: Optional[int] = None):
@@ -73,20 +104,122 @@ class FileObject(AbstractFileObject):
         # currently overwrites data given offset and buffer size, does not overwrite with zeros with different
         # creation options
         # incase input size differs from actual buffer size
+        if size is not None:
+            buffer = buffer[:size]
         if self.data is None:
-            if size is not None:
-                self.data = buffer[:size]
-                self.file_offset += size
-            else:
-                self.data = buffer
-                self.file_offset += len(buffer)
-        else:
-            if size is not None:
-                self.data = self.data[:self.file_offset] + buffer[:size] + self.data[self.file_offset+size:]
-                self.file_offset += size
+            self.data = bytearray()
+        elif self._shared or not isinstance(self.data, bytearray):
+            self.data = bytearray(self.data)
+        self._shared = False
+        if self.file_offset > len(self.data):
+            # Writing past the end of the file fills the gap with zeros
+            self.data.extend(bytes(self.file_offset - len(self.data)))
+        # Overwrites (and appends) in place
+        self.data[self.file_offset:self.file_offset + len(buffer)] = buffer
+        self.file_offset += len(buffer)
+
+class MappedFileObject(AbstractFileObject):
+    """
+    File backed by a host file that is mapped with mmap, the host file is never modified. Writes go to an overlay of
+    chunks (which can extend the file) and only those chunks are copied, so files larger than memory can be read.
+    """
+    CHUNK_SIZE = 0x10000
+
+    def __init__(self, path: str, host_path: Optional[str] = None):
+        super().__init__(path)
+        self.file_offset = 0
+        self._mapping: Optional[mmap.mmap] = None
+        self._size = 0
+        # chunk index -> data, written chunks are owned until the next snapshot copy
+        self._overlay: Dict[int, bytearray] = {}
+        self._owned: Set[int] = set()
+        with open(host_path or path, "rb") as f:
+            self._size = os.fstat(f.fileno()).st_size
+            if self._size > 0:
+                self._mapping = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._mapped_size = self._size
+
+    def __str__(self):
+        return self.pretty("path", "file_offset")
+
+    def __deepcopy__(self, memo):
+        # The mapping is read-only and shared, the overlay chunks are copied on write
+        copy = MappedFileObject.__new__(MappedFileObject)
+        copy.__dict__.update(self.__dict__)
+        copy._overlay = dict(self._overlay)
+        copy._owned = set()
+        self._owned = set()
+        memo[id(self)] = copy
+        return copy
+
+    @property
+    def size(self) -> int:
+        return self._size
+
+    def _chunks(self, offset: int, size: int):
+        # Yields (chunk index, offset in the chunk, length) for a range of the file
+        end = offset + size
+        while offset < end:
+            index, chunk_offset = divmod(offset, self.CHUNK_SIZE)
+            length = min(self.CHUNK_SIZE - chunk_offset, end - offset)
+            yield index, chunk_offset, length
+            offset += length
+
+    def _read_range(self, offset: int, size: int):
+        # Yields the pieces of the file data in the range
+        for index, chunk_offset, length in self._chunks(offset, size):
+            chunk = self._overlay.get(index, None)
+            if chunk is not None:
+                yield chunk[chunk_offset:chunk_offset + length]
             else:
-                self.data = self.data[:self.file_offset] + buffer + self.data[self.file_offset + len(buffer):]
-                self.file_offset += len(buffer)
+                start = index * self.CHUNK_SIZE + chunk_offset
+                data = self._mapping[start:start + length] if self._mapping is not None else b""
+                if len(data) < length:
+                    # Gap between the end of the host file and data written beyond it
+                    data += bytes(length - len(data))
+                yield data
+
+    def _available(self, size: Optional[int]) -> int:
+        if size is None:
+            size = self._size
+        return max(0, min(size, self._size - self.file_offset))
+
+    def read(self, size: Optional[int] = None) -> bytes:
+        size = self._available(size)
+        data = b"".join(self._read_range(self.file_offset, size))
+        self.file_offset += len(data)
+        return data
+
+    def read_into(self, dp: "Dumpulator", address: int, size: int) -> int:
+        size = self._available(size)
+        # Copy chunk by chunk, without building the whole buffer on the host
+        for data in self._read_range(self.file_offset, size):
+            dp.write(address, data)
+            address += len(data)
+        self.file_offset += size
+        return size
+
+    def write(self, buffer: bytes, size: Optional[int] = None):
+        if size is not None:
+            buffer = buffer[:size]
+        position = 0
+        for index, chunk_offset, length in self._chunks(self.file_offset, len(buffer)):
+            chunk = self._overlay.get(index, None)
+            if chunk is None or index not in self._owned:
+                if chunk is None:
+                    start = index * self.CHUNK_SIZE
+                    chunk = bytearray(self.CHUNK_SIZE)
+                    if self._mapping is not None and start < self._mapped_size:
+                        original = self._mapping[start:start + self.CHUNK_SIZE]
+                        chunk[:len(original)] = original
+                else:
+                    chunk = bytearray(chunk)
+                self._overlay[index] = chunk
+                self._owned.add(index)
+            chunk[chunk_offset:chunk_offset + length] = buffer[position:position + length]
+            position += length
+        self.file_offset += len(buffer)
+        self._size = max(self._size, self.file_offset)
 
 class ConsoleType(Enum):
     In = 0
@@ -125,7 +258,7 @@ class ConsoleFileObject(AbstractFileObject):
 
     def write(self, buffer: bytes, size: Optional[int] = None):
         assert self.type != ConsoleType.In, "cannot write to stdin"
-        print(f"std{'out' if self.type == ConsoleType.Out else 'err'}: {buffer}")
+        print(f"std{'out' if self.type == ConsoleType.Out else 'err'}: {bytes(buffer)}")
 
 @dataclass
 class SectionObject(AbstractObject):
@@ -183,11 +316,10 @@ class EventObject(AbstractObject):
     signalled: bool
 
 class RegistryKeyObject(AbstractObject):
-    def __init__(self, key: str, values: Dict[str, Any] = None):
-        if values is None:
-            values = {}
+    def __init__(self, key: str, node: Optional[RegistryKey] = None):
         self.key = key
-        self.values = values
+        # None for the keys of handles in the dump that are not in the registry
+        self.node = node
 
     def __str__(self):
         return self.pretty("key")
@@ -196,45 +328,101 @@ class RegistryKeyObject(AbstractObject):
 class ThreadObject(AbstractObject):
     entry: int
     argument: int = 0
+    thread_id: int = 0
+    # Set when the thread terminated (the thread object is signalled)
+    exit_status: Optional[int] = None
 
 class HandleManager:
+    """
+    Handle table like the one in the Windows kernel: the entries are indexed by (handle - 0x100) / 4 and closed
+    entries go on a free list. A reused entry gets the next generation, which is stored in bits 24-30 of the handle
+    value, so a stale handle does not resolve to the new object (until the generation wraps around).
+    """
+    INDEX_BITS = 24
+    GENERATION_MASK = 0x7F
+
     def __init__(self):
-        self._handles = {}
-        self._free_handles = []
+        self._objects: List[Optional[AbstractObject]] = []
+        self._generations: List[int] = []
+        # Reused in FIFO order to make a stale handle hit the same generation as late as possible
+        self._free_handles: Deque[int] = deque()
+        # Predefined handles passed to add()
+        self._fixed: Dict[int, AbstractObject] = {}
         self._base_handle = 0x100
-        self._handle_id = 0
         self._mapped_files = {}
+        self.registry = RegistryHive()
+        # Statistics
+        self.created = 0
+        self.closed = 0
+        self.open_count = 0
+        self.peak_count = 0
+
+    def _encode(self, index: int) -> int:
+        return (self._generations[index] << self.INDEX_BITS) | (self._base_handle + 4 * index)
+
+    def _index(self, handle_value: int) -> int:
+        # Returns the entry index of a handle value (with the low bits masked), or -1 if it is not in the table
+        offset = (handle_value & ((1 << self.INDEX_BITS) - 1)) - self._base_handle
+        if offset < 0 or handle_value >> (self.INDEX_BITS + 7) != 0:
+            return -1
+        index = offset >> 2
+        if index >= len(self._objects) or self._objects[index] is None:
+            return -1
+        if self._generations[index] != handle_value >> self.INDEX_BITS:
+            return -1
+        return index
 
     def __find_free_handle(self) -> int:
-        def helper():
-            if not self._free_handles:
-                key = self._base_handle + (0x4 * self._handle_id)
-                self._handle_id += 1
-                return key
-            return self._free_handles.pop(0)
-        # Make sure the handle isn't manually added by the user
         while True:
-            free_handle = helper()
-            if free_handle not in self._handles:
-                return free_handle
+            if self._free_handles:
+                index = self._free_handles.popleft()
+                self._generations[index] = (self._generations[index] + 1) & self.GENERATION_MASK
+            else:
+                index = len(self._objects)
+                assert self._base_handle + 4 * index < (1 << self.INDEX_BITS), "Handle table is full"
+                self._objects.append(None)
+                self._generations.append(0)
+            handle_value = self._encode(index)
+            # Make sure the handle isn't manually added by the user
+            if handle_value not in self._fixed:
+                return handle_value
+            self._free_handles.append(index)
+
+    def _insert(self, handle_value: int, handle_data: AbstractObject):
+        index = ((handle_value & ((1 << self.INDEX_BITS) - 1)) - self._base_handle) >> 2
+        self._objects[index] = handle_data
+        self.created += 1
+        self.open_count += 1
+        if self.open_count > self.peak_count:
+            self.peak_count = self.open_count
 
     # create new handle object and returns handle value
     def new(self, handle_data: AbstractObject) -> int:
         handle_value = self.__find_free_handle()
-        self._handles[handle_value] = handle_data
+        self._insert(handle_value, handle_data)
         return handle_value
 
     # used to add predefined known handles
     def add(self, handle_value: int, handle_data: AbstractObject):
-        assert handle_value not in self._handles.keys()
-        self._handles[handle_value] = handle_data
+        assert not self.valid(handle_value)
+        self._fixed[handle_value] = handle_data
+        self.created += 1
+        self.open_count += 1
+        if self.open_count > self.peak_count:
+            self.peak_count = self.open_count
 
     # returns any object data held for the handle
     def get(self, handle_value: int, handle_type: Type[T]) -> T:
-        handle_data = self._handles.get(handle_value & ~3, None)
-        if handle_data is None:
-            return None
-        if handle_type is not None:
+        handle_value &= ~3
+        index = self._index(handle_value)
+        if index >= 0:
+            handle_data = self._objects[index]
+        else:
+            handle_data = self._fixed.get(handle_value, None)
+            if handle_data is None:
+                return None
+        # The exact type check is much cheaper than isinstance for the common case
+        if handle_type is not None and type(handle_data) is not handle_type:
             assert issubclass(handle_type, AbstractObject)
             if not isinstance(handle_data, handle_type):
                 raise TypeError(f"Expected {handle_type.__name__} got {type(handle_data).__name__}")
@@ -243,28 +431,59 @@ class HandleManager:
     # replaces object data for a handle (make sure there are no dangling references)
     def replace(self, handle_value: int, handle_data: AbstractObject):
         handle_value &= ~3
-        assert handle_value in self._handles
-        self._handles[handle_value] = handle_data
+        index = self._index(handle_value)
+        if index >= 0:
+            self._objects[index] = handle_data
+        else:
+            assert handle_value in self._fixed
+            self._fixed[handle_value] = handle_data
 
     def valid(self, handle_value: int) -> bool:
-        return handle_value in self._handles.keys()
+        handle_value &= ~3
+        return self._index(handle_value) >= 0 or handle_value in self._fixed
 
-    # decrements ref_count and removes the key from the dict
+    # removes the handle, the entry is reused with the next generation
     def close(self, handle_value: int) -> bool:
-        if handle_value in self._handles.keys():
-            del self._handles[handle_value]
-            # Make sure all handles are unique
-            # self.free_handles.append(handle_value)
-            return True
-        return False
+        handle_value &= ~3
+        index = self._index(handle_value)
+        if index >= 0:
+            self._objects[index] = None
+            self._free_handles.append(index)
+        elif self._fixed.pop(handle_value, None) is None:
+            return False
+        self.closed += 1
+        self.open_count -= 1
+        return True
 
     # copies object ref to a new key (handle) and increments ref_count
     def duplicate(self, handle_value: int) -> int:
-        assert handle_value in self._handles.keys()
-        handle_object = self._handles[handle_value]
-        new_handle_value = self.__find_free_handle()
-        self._handles[new_handle_value] = handle_object
-        return new_handle_value
+        handle_object = self.get(handle_value, None)
+        assert handle_object is not None
+        return self.new(handle_object)
+
+    def __iter__(self):
+        # Yields (handle value, object) for the open handles
+        for index, handle_data in enumerate(self._objects):
+            if handle_data is not None:
+                yield self._encode(index), handle_data
+        yield from self._fixed.items()
+
+    def statistics(self) -> Dict[str, Any]:
+        """
+        Handle counts, the open handles by type show what the guest leaked when it exits.
+        """
+        open_by_type: Dict[str, int] = {}
+        for _, handle_data in self:
+            name = type(handle_data).__name__
+            open_by_type[name] = open_by_type.get(name, 0) + 1
+        return {
+            "created": self.created,
+            "closed": self.closed,
+            "open": self.open_count,
+            "peak": self.peak_count,
+            "table_size": len(self._objects),
+            "open_by_type": dict(sorted(open_by_type.items(), key=lambda item: item[1], reverse=True)),
+        }
 
     def map_file(self, filename: str, handle_data: Any):
         self._mapped_files[filename.lower()] = handle_data
@@ -272,7 +491,10 @@ class HandleManager:
     def open_file(self, filename: str):
         data = self._mapped_files.get(filename.lower(), None)
         if data is None:
-            return None
+            node = self.registry.find(filename) if filename[:10].lower() == "\\registry\\" else None
+            if node is None:
+                return None
+            data = RegistryKeyObject(node.path, node)
         return self.new(data)
 
     def create_file(self, filename: str, options: int) -> bool:
@@ -284,9 +506,7 @@ class HandleManager:
         elif options == FILE_OPEN or options == FILE_OVERWRITE:
             file = Path(filename)
             if file.exists():
-                with file.open("rb") as f:
-                    file_data = f.read()
-                    self.map_file(filename, FileObject(filename, file_data))
+                self.map_file(filename, MappedFileObject(filename))
                 return True
         # if file does not exist create a new FileObject
         elif options == FILE_CREATE:
@@ -304,18 +524,16 @@ class HandleManager:
         elif options == FILE_OPEN_IF or options == FILE_OVERWRITE_IF:
             file = Path(filename)
             if file.exists():
-                with file.open("rb") as f:
-                    file_data = f.read()
-                    self.map_file(filename, FileObject(filename, file_data))
-                    return True
+                self.map_file(filename, MappedFileObject(filename))
+                return True
             else:
                 self.map_file(filename, FileObject(filename))
                 return True
         return False
 
-    def create_key(self, key: str, values: Dict[str, Any] = None):
-        if values is None:
-            values = {}
-        data = RegistryKeyObject(key, values)
-        self._mapped_files[key.lower()] = data
-        return data
+    def create_key(self, key: str, values: Dict[str, Any] = None) -> RegistryKeyObject:
+        node = self.registry.create(key, values)
+        return RegistryKeyObject(node.path, node)
+
+    def load_registry(self, filename: str, current_user: str = ".DEFAULT"):
+        self.registry.load_reg(filename, current_user)
@@ -0,0 +1,119 @@
+import inspect
+
+from .dumpulator import Dumpulator, HleFunction
+from .memory import PAGE_SIZE
+
+def hle(module: str, name: str, *, stdcall: bool = False):
+    """
+    Register a high-level implementation of an export. The callback receives the arguments of the call and returns
+    the value for cax, returning None executes the original code instead. The hooks are installed when the
+    Dumpulator instance is created (use Dumpulator.install_hle for modules mapped later).
+    """
+    def decorator(func):
+        argcount = len(inspect.signature(func).parameters) - 1
+        from .dumpulator import hle_functions
+        hle_functions[(module.lower(), name)] = HleFunction(f"{module.lower()}:{name}", func, argcount, stdcall)
+        return func
+    return decorator
+
+# Strings longer than this are left to the guest implementation
+MAX_STRING_LENGTH = 0x100000
+
+def _string_length(dp: Dumpulator, addr: int, char_size: int):
+    terminator = bytes(char_size)
+    data = bytearray()
+    ptr = addr
+    search = 0
+    while len(data) < MAX_STRING_LENGTH:
+        size = PAGE_SIZE - (ptr & 0xFFF)
+        if not dp._pages.accessible(ptr, size):
+            return None
+        data += dp._pages.read(ptr, size)
+        ptr += size
+        while True:
+            index = data.find(terminator, search)
+            if index == -1:
+                # The terminator can cross the page boundary
+                search = max(0, len(data) - char_size + 1)
+                break
+            if index % char_size == 0:
+                return index // char_size
+            search = index + 1
+    return None
+
+def _memmove(dp: Dumpulator, dst: int, src: int, size: int):
+    if size == 0:
+        return dst
+    pages = dp._pages
+    if not pages.accessible(src, size) or not pages.accessible(dst, size, write=True):
+        return None
+    pages.copy(dst, src, size)
+    return dst
+
+def _memset(dp: Dumpulator, dst: int, value: int, size: int):
+    if size == 0:
+        return dst
+    if not dp._pages.accessible(dst, size, write=True):
+        return None
+    dp._pages.fill(dst, size, value)
+    return dst
+
+def _compare(dp: Dumpulator, a: int, b: int, size: int):
+    # Returns the index of the first difference, or None if the guest has to handle the call
+    if size == 0:
+        return 0
+    pages = dp._pages
+    if not pages.accessible(a, size) or not pages.accessible(b, size):
+        return None
+    return pages.compare(a, b, size)
+
+@hle("ntdll.dll", "memcpy")
+def memcpy(dp: Dumpulator, dst: int, src: int, size: int):
+    return _memmove(dp, dst, src, size)
+
+@hle("ntdll.dll", "memmove")
+def memmove(dp: Dumpulator, dst: int, src: int, size: int):
+    return _memmove(dp, dst, src, size)
+
+@hle("ntdll.dll", "RtlMoveMemory", stdcall=True)
+def RtlMoveMemory(dp: Dumpulator, dst: int, src: int, size: int):
+    return _memmove(dp, dst, src, size)
+
+@hle("ntdll.dll", "RtlCopyMemory", stdcall=True)
+def RtlCopyMemory(dp: Dumpulator, dst: int, src: int, size: int):
+    return _memmove(dp, dst, src, size)
+
+@hle("ntdll.dll", "memset")
+def memset(dp: Dumpulator, dst: int, value: int, size: int):
+    return _memset(dp, dst, value, size)
+
+@hle("ntdll.dll", "RtlFillMemory", stdcall=True)
+def RtlFillMemory(dp: Dumpulator, dst: int, size: int, value: int):
+    return _memset(dp, dst, value, size)
+
+@hle("ntdll.dll", "RtlZeroMemory", stdcall=True)
+def RtlZeroMemory(dp: Dumpulator, dst: int, size: int):
+    return _memset(dp, dst, 0, size)
+
+@hle("ntdll.dll", "memcmp")
+def memcmp(dp: Dumpulator, a: int, b: int, size: int):
+    index = _compare(dp, a, b, size)
+    if index is None:
+        return None
+    if index == size:
+        return 0
+    left = dp._pages.read(a + index, 1)[0]
+    right = dp._pages.read(b + index, 1)[0]
+    return 1 if left > right else -1
+
+@hle("ntdll.dll", "RtlCompareMemory", stdcall=True)
+def RtlCompareMemory(dp: Dumpulator, a: int, b: int, size: int):
+    return _compare(dp, a, b, size)
+
+@hle("ntdll.dll", "strlen")
+def strlen(dp: Dumpulator, s: int):
+    return _string_length(dp, s, 1)
+
+@hle("ntdll.dll", "wcslen")
+def wcslen(dp: Dumpulator, s: int):
+    return _string_length(dp, s, 2)
@@ -1,6 +1,6 @@
 import bisect
 from enum import Enum, Flag
-from dataclasses import dataclass, field
+from dataclasses import dataclass, field, replace
 from typing import Any, List, Dict, Union, Optional
 
 PAGE_SIZE = 0x1000
@@ -26,6 +26,34 @@ class MemoryProtect(Flag):
             result = super().__str__().replace(f"{self.__class__.__name__}.", "")
         return result
 
+    @property
+    def writable(self) -> bool:
+        if self & MemoryProtect.PAGE_GUARD:
+            return False
+        writable_mask = MemoryProtect.PAGE_READWRITE | MemoryProtect.PAGE_WRITECOPY | MemoryProtect.PAGE_EXECUTE_READWRITE | MemoryProtect.PAGE_EXECUTE_WRITECOPY
+        return bool(self & writable_mask)
+
+    @property
+    def readable(self) -> bool:
+        if self & MemoryProtect.PAGE_GUARD:
+            return False
+        return not (self == MemoryProtect.UNDEFINED or self & (MemoryProtect.PAGE_NOACCESS | MemoryProtect.PAGE_EXECUTE))
+
+    @property
+    def executable(self) -> bool:
+        execute_mask = MemoryProtect.PAGE_EXECUTE | MemoryProtect.PAGE_EXECUTE_READ | MemoryProtect.PAGE_EXECUTE_READWRITE | MemoryProtect.PAGE_EXECUTE_WRITECOPY
+        return bool(self & execute_mask)
+
+    def read_only(self) -> "MemoryProtect":
+        # Returns the same protection with the write access removed
+        modifiers = self & (MemoryProtect.PAGE_GUARD | MemoryProtect.PAGE_NOCACHE | MemoryProtect.PAGE_WRITECOMBINE)
+        base = self & ~modifiers
+        if base in [MemoryProtect.PAGE_READWRITE, MemoryProtect.PAGE_WRITECOPY]:
+            base = MemoryProtect.PAGE_READONLY
+        elif base in [MemoryProtect.PAGE_EXECUTE_READWRITE, MemoryProtect.PAGE_EXECUTE_WRITECOPY]:
+            base = MemoryProtect.PAGE_EXECUTE_READ
+        return base | modifiers
+
 class MemoryType(Enum):
     UNDEFINED = 0
     MEM_IMAGE = 0x1000000
@@ -121,14 +149,40 @@ class MemoryBasicInformation:
     def __str__(self):
         return f"MemoryBasicInformation(base: {hex(self.base)}, allocation_base: {hex(self.allocation_base)}, region_size: {hex(self.region_size)}, state: {self.state}, protect: {self.protect}, type: {self.type})"
 
+@dataclass
+class MemoryManagerSnapshot:
+    regions: List[MemoryRegion]
+    committed: List[MemoryRegion]
+    free: List[MemoryRegion]
+    generation: int
+
 @dataclass
 class MemoryManager:
     _page_manager: PageManager
     _minimum: int = 0x10000
     _maximum: int = 0x7fffffff0000
     _granularity: int = 0x10000
+    # Reserved regions, sorted by address
     _regions: List[MemoryRegion] = field(default_factory=list)
-    _committed: Dict[int, MemoryRegion] = field(default_factory=dict)
+    # Committed page ranges, sorted by address. A range never crosses a reserved region and adjacent ranges with the
+    # same attributes are merged, so committing a large range only adds a single entry.
+    _committed: List[MemoryRegion] = field(default_factory=list)
+    # Free gaps between the reserved regions, sorted by address
+    _free: List[MemoryRegion] = field(default_factory=list)
+    # The same gaps by size class (bit length of the size), each sorted by address
+    _free_index: Dict[int, List[MemoryRegion]] = field(default_factory=dict)
+    # Incremented on every change to the bookkeeping, used to skip redundant restores
+    _generation: int = 0
+
+    def __post_init__(self):
+        if not self._regions and not self._free:
+            self._free.append(MemoryRegion(self._minimum, self._maximum - self._minimum))
+        self._build_free_index()
+
+    # Returns the index of the last region starting at or before addr (-1 if there is none)
+    @staticmethod
+    def _bisect(regions: List[MemoryRegion], addr: int) -> int:
+        return bisect.bisect_right(regions, MemoryRegion(addr, 0)) - 1
 
     def find_region(self, region: Union[MemoryRegion, int]) -> Optional[MemoryRegion]:
         if isinstance(region, int):
@@ -143,9 +197,13 @@ class MemoryManager:
             else:
                 return None
 
+    # Returns the committed range containing this address
     def find_commit(self, addr: int) -> Optional[MemoryRegion]:
         addr = self.containing_page(addr)
-        return self._committed.get(addr, None)
+        index = self._bisect(self._committed, addr)
+        if index >= 0 and addr in self._committed[index]:
+            return self._committed[index]
+        return None
 
     # Rounds down to the page containing this address
     @staticmethod
@@ -165,23 +223,83 @@ class MemoryManager:
         return (addr + mask) & ~mask
 
     def find_free(self, size: int, allocation_align=True) -> Optional[int]:
+        """
+        Returns the lowest address of a free range of size bytes. Only the size classes that can fit the range are
+        searched: the first gap of a class that always fits is a candidate, the (few) classes where only some of the
+        gaps fit are scanned in address order up to the best candidate.
+        """
         assert size > 0 and self.align_page(size) == size
-        base = self._minimum
-        while base < self._maximum:
-            info = self.query(base)
-            assert info.base == base
-            base += info.region_size
-            if info.state == MemoryState.MEM_FREE:
-                if allocation_align:
-                    aligned_base = self.align_allocation(info.base)
-                    diff = aligned_base - info.base
-                    info.base = aligned_base
-                    info.region_size -= diff
-                if info.region_size >= size:
-                    return info.base
-        return None
+        # Aligning the start of a gap (always page aligned) wastes at most this much
+        slack = self._granularity - PAGE_SIZE if allocation_align else 0
+        result = None
+        for size_class, gaps in self._free_index.items():
+            if (1 << size_class) <= size:
+                # Every gap in this class is smaller than size
+                continue
+            if (1 << (size_class - 1)) >= size + slack:
+                candidates = gaps[:1]
+            else:
+                candidates = gaps
+            for gap in candidates:
+                if result is not None and gap.start >= result:
+                    break
+                base = self.align_allocation(gap.start) if allocation_align else gap.start
+                if gap.end - base >= size:
+                    result = base
+                    break
+        return result
+
+    def _build_free_index(self):
+        self._free_index = {}
+        for gap in self._free:
+            self._free_index.setdefault(gap.size.bit_length(), []).append(gap)
+
+    def _index_free(self, gap: MemoryRegion):
+        bisect.insort(self._free_index.setdefault(gap.size.bit_length(), []), gap)
+
+    def _unindex_free(self, gap: MemoryRegion):
+        size_class = gap.size.bit_length()
+        gaps = self._free_index[size_class]
+        index = bisect.bisect_left(gaps, gap)
+        assert gaps[index] is gap
+        del gaps[index]
+        if not gaps:
+            del self._free_index[size_class]
+
+    def _take_free(self, region: MemoryRegion):
+        index = self._bisect(self._free, region.start)
+        assert index >= 0
+        gap = self._free[index]
+        assert region in gap
+        self._unindex_free(gap)
+        remaining = []
+        if gap.start < region.start:
+            remaining.append(MemoryRegion(gap.start, region.start - gap.start))
+        if region.end < gap.end:
+            remaining.append(MemoryRegion(region.end, gap.end - region.end))
+        self._free[index:index + 1] = remaining
+        for gap in remaining:
+            self._index_free(gap)
+
+    def _add_free(self, region: MemoryRegion):
+        index = self._bisect(self._free, region.start) + 1
+        gap = MemoryRegion(region.start, region.size)
+        # Merge with the adjacent gaps
+        if index < len(self._free) and self._free[index].start == gap.end:
+            self._unindex_free(self._free[index])
+            gap.size += self._free[index].size
+            del self._free[index]
+        if index > 0 and self._free[index - 1].end == gap.start:
+            gap_before = self._free[index - 1]
+            self._unindex_free(gap_before)
+            gap_before.size += gap.size
+            self._index_free(gap_before)
+        else:
+            self._free.insert(index, gap)
+            self._index_free(gap)
 
     def reserve(self, start: int, size: int, protect: MemoryProtect, memory_type: MemoryType = MemoryType.MEM_PRIVATE, info: Any = None) -> MemoryRegion:
+        self._generation += 1
         assert isinstance(protect, MemoryProtect)
         assert isinstance(memory_type, MemoryType)
         assert size > 0 and self.align_page(size) == size
@@ -203,32 +321,78 @@ class MemoryManager:
             check_overlaps(index - 1)
             check_overlaps(index)
         self._regions.insert(index, region)
+        self._take_free(region)
         return region
 
+    # Makes sure no committed range crosses addr, returns the index of the first range starting at or after addr
+    def _split_commit(self, addr: int) -> int:
+        index = self._bisect(self._committed, addr)
+        if index < 0:
+            return 0
+        commit = self._committed[index]
+        if commit.start == addr:
+            return index
+        if addr < commit.end:
+            after = replace(commit, start=addr, size=commit.end - addr)
+            commit.size = addr - commit.start
+            self._committed.insert(index + 1, after)
+        return index + 1
+
+    # Splits the committed ranges at the boundaries, returns the (first, last) indices of the ranges inside
+    def _commit_range(self, start: int, end: int):
+        first = self._split_commit(start)
+        last = self._split_commit(end)
+        return first, last
+
+    # Merges the compatible adjacent ranges around the (first, last) indices
+    def _merge_commits(self, parent_region: MemoryRegion, first: int, last: int):
+        index = max(first - 1, 0)
+        last = min(last, len(self._committed) - 1)
+        while index < last:
+            current = self._committed[index]
+            following = self._committed[index + 1]
+            if current.end == following.start and \
+                    current.start >= parent_region.start and following.end <= parent_region.end and \
+                    current.protect == following.protect and current.type == following.type and current.info == following.info:
+                current.size += following.size
+                del self._committed[index + 1]
+                last -= 1
+            else:
+                index += 1
+
+    def _count_commits(self, region: MemoryRegion) -> int:
+        count = 0
+        index = self._bisect(self._committed, region.start)
+        if index < 0 or self._committed[index].end <= region.start:
+            index += 1
+        while index < len(self._committed) and self._committed[index].start < region.end:
+            commit = self._committed[index]
+            count += (min(commit.end, region.end) - max(commit.start, region.start)) // PAGE_SIZE
+            index += 1
+        return count
+
     def _decommit_region(self, parent_region: MemoryRegion, decommit_region: MemoryRegion):
         assert decommit_region in parent_region
+        first, last = self._commit_range(decommit_region.start, decommit_region.end)
         release_start = None
-        release_count = 0
-        for page in decommit_region.pages():
-            if page in self._committed:
-                release_count += 1
-                if release_start is None:
-                    release_start = page
-            elif release_count > 0:
-                self._page_manager.decommit(release_start, release_count * PAGE_SIZE)
-                for i in range(release_count):
-                    del self._committed[release_start + i * PAGE_SIZE]
-                    parent_region.commit_count -= 1
-                release_start = None
-                release_count = 0
-
-        if release_count > 0:
-            self._page_manager.decommit(release_start, release_count * PAGE_SIZE)
-            for i in range(release_count):
-                del self._committed[release_start + i * PAGE_SIZE]
-                parent_region.commit_count -= 1
+        release_end = None
+        for commit in self._committed[first:last]:
+            parent_region.commit_count -= commit.size // PAGE_SIZE
+            if release_end == commit.start:
+                release_end = commit.end
+                continue
+            if release_start is not None:
+                self._page_manager.decommit(release_start, release_end - release_start)
+            release_start = commit.start
+            release_end = commit.end
+
+        if release_start is not None:
+            self._page_manager.decommit(release_start, release_end - release_start)
+        del self._committed[first:last]
+        self._merge_commits(parent_region, first, first)
 
     def release(self, start: int, size: int = 0) -> None:
+        self._generation += 1
         assert self.align_allocation(start) == start
         assert self.align_allocation(size) == size
 
@@ -243,7 +407,10 @@ class MemoryManager:
 
         decommit = MemoryRegion(start, size)
         self._decommit_region(parent, decommit)
-        self._regions.remove(parent)
+        index = self._bisect(self._regions, parent.start)
+        assert self._regions[index] is parent
+        del self._regions[index]
+        self._add_free(parent)
 
         before = MemoryRegion(parent.start, decommit.start - parent.start)
         after = MemoryRegion(decommit.end, parent.end - decommit.end)
@@ -254,18 +421,15 @@ class MemoryManager:
 
         if before.size > 0:
             before = self.reserve(before.start, before.size, parent.protect, parent.type, parent.info)
-            for page in before.pages():
-                if page in self._committed:
-                    before.commit_count += 1
+            before.commit_count = self._count_commits(before)
         if after.size > 0:
             after = self.reserve(after.start, after.size, parent.protect, parent.type, parent.info)
-            for page in after.pages():
-                if page in self._committed:
-                    after.commit_count += 1
+            after.commit_count = self._count_commits(after)
 
         assert before.commit_count + after.commit_count == parent.commit_count
 
     def commit(self, start: int, size: int, protect: MemoryProtect = MemoryProtect.UNDEFINED) -> None:
+        self._generation += 1
         assert isinstance(protect, MemoryProtect)
         assert size > 0 and self.align_page(size) == size
         assert self.containing_page(start) == start
@@ -277,25 +441,28 @@ class MemoryManager:
         if protect == MemoryProtect.UNDEFINED:
             protect = parent_region.protect
 
-        if parent_region.commit_count == 0:
-            assert all([page not in self._committed for page in region.pages()])
-            self._page_manager.commit(region.start, region.size, protect)
-            for page in region.pages():
-                self._committed[page] = MemoryRegion(page, PAGE_SIZE, protect, parent_region.type)
-                parent_region.commit_count += 1
-        else:
-            for page in region.pages():
-                if page in self._committed:
-                    page_region = self._committed[page]
-                    if page_region.protect != protect:
-                        self._page_manager.protect(page, PAGE_SIZE, protect)
-                        page_region.protect = protect
-                else:
-                    self._page_manager.commit(page, PAGE_SIZE, protect)
-                    self._committed[page] = MemoryRegion(page, PAGE_SIZE, protect, parent_region.type)
-                    parent_region.commit_count += 1
+        # Commit the gaps and change the protection of the pages that are already committed
+        first, last = self._commit_range(region.start, region.end)
+        commits = self._committed[first:last]
+        addr = region.start
+        result = []
+        for commit in commits + [None]:
+            gap_end = region.end if commit is None else commit.start
+            if addr < gap_end:
+                self._page_manager.commit(addr, gap_end - addr, protect)
+                result.append(MemoryRegion(addr, gap_end - addr, protect, parent_region.type))
+                parent_region.commit_count += (gap_end - addr) // PAGE_SIZE
+            if commit is not None:
+                if commit.protect != protect:
+                    self._page_manager.protect(commit.start, commit.size, protect)
+                    commit.protect = protect
+                result.append(commit)
+                addr = commit.end
+        self._committed[first:last] = result
+        self._merge_commits(parent_region, first, first + len(result))
 
     def decommit(self, start: int, size: int) -> None:
+        self._generation += 1
         assert size > 0 and self.align_page(size) == size
         assert self.containing_page(start) == start
         region = MemoryRegion(start, size)
@@ -306,6 +473,7 @@ class MemoryManager:
         self._decommit_region(parent_region, region)
 
     def protect(self, start: int, size: int, protect: MemoryProtect) -> MemoryProtect:
+        self._generation += 1
         assert isinstance(protect, MemoryProtect)
         assert size > 0 and self.align_page(size) == size
         assert self.containing_page(start) == start
@@ -315,17 +483,22 @@ class MemoryManager:
             raise KeyError(f"Could not find parent for {region}")
 
         # Make sure all pages in the region are committed
-        for page in region.pages():
-            if not self._committed[page]:
-                raise KeyError(f"Could not protect uncommitted page {hex(page)}")
+        first, last = self._commit_range(region.start, region.end)
+        addr = region.start
+        for commit in self._committed[first:last] + [None]:
+            if commit is None and addr == region.end:
+                break
+            if commit is None or commit.start != addr:
+                self._merge_commits(parent_region, first, last)
+                raise KeyError(f"Could not protect uncommitted page {hex(addr)}")
+            addr = commit.end
 
         # Change the protection
-        old_protect = self._committed[region.start].protect
+        old_protect = self._committed[first].protect
         self._page_manager.protect(region.start, region.size, protect)
-        for page in region.pages():
-            page_region = self._committed[page]
-            if page_region.protect != protect:
-                page_region.protect = protect
+        for commit in self._committed[first:last]:
+            commit.protect = protect
+        self._merge_commits(parent_region, first, last)
 
         return old_protect
 
@@ -348,57 +521,49 @@ class MemoryManager:
             return result
 
         # Reference: https://learn.microsoft.com/en-us/windows/win32/api/memoryapi/nf-memoryapi-virtualquery#remarks
-        result: MemoryBasicInformation = None
         result_info = {}
-        def add_info(memory_region: MemoryRegion):
+        def add_info(memory_region: MemoryRegion, start_addr: int):
             if memory_region.info is None:
                 return
             if memory_region.info in result_info:
                 return
-            result_info[memory_region.info] = memory_region.start
-        for page in parent_region.pages():
-            if page < start:
-                continue
-            elif result is None:
-                result = MemoryBasicInformation(page, parent_region.start, parent_region.protect)
-                add_info(parent_region)
-                if page in self._committed:
-                    result.state = MemoryState.MEM_COMMIT
-                    committed_page = self._committed[page]
-                    result.protect = committed_page.protect
-                    result.type = committed_page.type
-                    add_info(committed_page)
-                    assert committed_page.type == parent_region.type
-                else:
-                    result.state = MemoryState.MEM_RESERVE
-                    result.protect = MemoryProtect.UNDEFINED
-                    result.type = parent_region.type
-                    # If no pages are committed in this parent region we can bail early
-                    if parent_region.commit_count == 0:
-                        result.region_size = parent_region.size
-                        break
-            else:
-                committed_page = self._committed.get(page, None)
-                if result.state == MemoryState.MEM_RESERVE:
-                    if committed_page is not None:
-                        break
-                    result.region_size += PAGE_SIZE
-                elif result.state == MemoryState.MEM_COMMIT:
-                    if committed_page is not None and committed_page.type == result.type and committed_page.protect == result.protect:
-                        result.region_size += PAGE_SIZE
-                        add_info(committed_page)
-                    else:
-                        break
-                else:
-                    assert False  # unreachable
+            result_info[memory_region.info] = start_addr
+        result = MemoryBasicInformation(start, parent_region.start, parent_region.protect)
+        add_info(parent_region, parent_region.start)
+        index = self._bisect(self._committed, start)
+        if index >= 0 and start in self._committed[index]:
+            committed = self._committed[index]
+            result.state = MemoryState.MEM_COMMIT
+            result.protect = committed.protect
+            result.type = committed.type
+            assert committed.type == parent_region.type
+            add_info(committed, start)
+            end = committed.end
+            # Merge the following committed ranges with the same attributes
+            for committed in self._committed[index + 1:]:
+                if committed.start != end or committed.end > parent_region.end:
+                    break
+                if committed.type != result.type or committed.protect != result.protect:
+                    break
+                add_info(committed, committed.start)
+                end = committed.end
+        else:
+            result.state = MemoryState.MEM_RESERVE
+            result.protect = MemoryProtect.UNDEFINED
+            result.type = parent_region.type
+            # The reserved range ends at the next committed range in the parent region
+            end = parent_region.end
+            if index + 1 < len(self._committed):
+                end = min(end, max(start, self._committed[index + 1].start))
+        result.region_size = end - start
+
         # Only keep information starting from the current page, or the parent page if none
-        if result is not None:
-            result.info = []
-            for info, start_addr in result_info.items():
-                if start_addr >= result.base:
-                    result.info.append(info)
-            if len(result.info) == 0 and len(result_info) > 0:
-                result.info = list(result_info.keys())[:1]
+        result.info = []
+        for info, start_addr in result_info.items():
+            if start_addr >= result.base:
+                result.info.append(info)
+        if len(result.info) == 0 and len(result_info) > 0:
+            result.info = list(result_info.keys())[:1]
 
         return result
 
@@ -417,25 +582,204 @@ class MemoryManager:
     def write(self, addr: int, data: bytes):
         return self._page_manager.write(addr, data)
 
+    def set_commit_info(self, addr: int, size: int, info: Any, *, overwrite=True) -> bool:
+        # Sets the info of the committed pages in the range (clamped to the parent region)
+        self._generation += 1
+        parent_region = self.find_region(addr)
+        if parent_region is None:
+            return False
+        start = max(self.align_page(addr), parent_region.start)
+        end = min(self.align_page(addr + size), parent_region.end)
+        if start >= end:
+            return True
+        first, last = self._commit_range(start, end)
+        for commit in self._committed[first:last]:
+            if overwrite or commit.info is None:
+                commit.info = info
+        self._merge_commits(parent_region, first, last)
+        return True
+
     def set_region_info(self, addr: int, info: Any, *, size=0):
+        self._generation += 1
         region = self.find_region(addr)
         if region is None:
             return False
 
         if size > 0:
-            for page in region.pages():
-                if page < addr:
-                    continue
-                if page >= addr + size:
-                    break
-                commit = self._committed.get(page)
-                if commit is not None and commit.info is None:
-                    commit.info = info
+            self.set_commit_info(addr, size, info, overwrite=False)
         else:
             if region.info is not None:
                 return False
             region.info = info
         return True
 
+    def snapshot(self) -> MemoryManagerSnapshot:
+        regions = [replace(region) for region in self._regions]
+        committed = [replace(region) for region in self._committed]
+        free = [replace(region) for region in self._free]
+        return MemoryManagerSnapshot(regions, committed, free, self._generation)
+
+    def restore(self, snapshot: MemoryManagerSnapshot):
+        # NOTE: the page manager is restored separately
+        if snapshot.generation == self._generation:
+            return
+        self._regions = [replace(region) for region in snapshot.regions]
+        self._committed = [replace(region) for region in snapshot.committed]
+        self._free = [replace(region) for region in snapshot.free]
+        self._build_free_index()
+        self._generation = snapshot.generation
+
     def __repr__(self):
         return f"MemoryManager(regions={len(self._regions)}, committed={len(self._committed)})"
+
+@dataclass
+class ArenaRegion:
+    base: int
+    size: int
+    ptr: int
+    # End of the committed part of the region (the pages are committed ahead of ptr)
+    committed: int
+
+    @property
+    def end(self):
+        return self.base + self.size
+
+@dataclass
+class ArenaMark:
+    region: int
+    # Bump pointers of the regions at the time of the mark
+    ptrs: List[int]
+    # Blocks taken from the free lists inside the scope, returned to them on reset
+    reused: List[tuple] = field(default_factory=list)
+
+class ScratchAllocator:
+    """
+    Scratch memory for the emulated code (Dumpulator.allocate). Allocations are bumped from reserved regions (more
+    are reserved when they run out) and the pages are committed in chunks ahead of the pointer. Freed blocks go to
+    a free list per size class. A mark/reset pair releases everything allocated in between.
+    """
+    MIN_CLASS = 0x10
+    # Blocks up to this size are rounded to a power of two, larger ones to pages
+    MAX_CLASS = 0x10000
+
+    def __init__(self, memory: MemoryManager, region_size=10 * 1024 * 1024, commit_size=0x10000):
+        self.memory = memory
+        self.region_size = region_size
+        self.commit_size = commit_size
+        self._regions: List[ArenaRegion] = []
+        self._current = 0
+        self._free: Dict[int, List[int]] = {}
+        self._sizes: Dict[int, int] = {}
+        self._marks: List[ArenaMark] = []
+
+    @classmethod
+    def size_class(cls, size: int) -> int:
+        if size > cls.MAX_CLASS:
+            return MemoryManager.align_page(size)
+        return max(cls.MIN_CLASS, 1 << (size - 1).bit_length())
+
+    def _reserve(self, size: int) -> ArenaRegion:
+        size = max(self.region_size, MemoryManager.align_page(size))
+        base = self.memory.find_free(size)
+        assert base is not None, "Failed to find free memory"
+        self.memory.reserve(base, size, MemoryProtect.PAGE_EXECUTE_READWRITE, MemoryType.MEM_PRIVATE, "allocated region")
+        region = ArenaRegion(base, size, base, base)
+        self._regions.append(region)
+        return region
+
+    def _bump(self, size: int, alignment: int) -> int:
+        while True:
+            if self._current < len(self._regions):
+                region = self._regions[self._current]
+                ptr = (region.ptr + alignment - 1) & ~(alignment - 1)
+                if ptr + size <= region.end:
+                    break
+                if self._current + 1 < len(self._regions):
+                    self._current += 1
+                    continue
+            region = self._reserve(size)
+            ptr = region.base
+            if size < self.region_size:
+                self._current = len(self._regions) - 1
+            # Otherwise the region is dedicated to this allocation and the current region keeps its free space
+            break
+        region.ptr = ptr + size
+        if region.ptr > region.committed:
+            # Commit a whole chunk at once instead of a few pages per allocation
+            end = min(region.end, MemoryManager.align_page(region.ptr + self.commit_size))
+            self.memory.commit(region.committed, end - region.committed)
+            region.committed = end
+        return ptr
+
+    def allocate(self, size: int, page_align=False) -> int:
+        size = max(size, 1)
+        if page_align:
+            size_class = MemoryManager.align_page(size)
+        else:
+            size_class = self.size_class(size)
+        free = self._free.get(size_class, None)
+        if free:
+            ptr = free.pop()
+            if self._marks:
+                self._marks[-1].reused.append((ptr, size_class))
+        else:
+            alignment = PAGE_SIZE if page_align or size_class >= PAGE_SIZE else min(size_class, 0x10)
+            ptr = self._bump(size_class, alignment)
+        self._sizes[ptr] = size_class
+        return ptr
+
+    def free(self, ptr: int):
+        size_class = self._sizes.pop(ptr, None)
+        if size_class is None:
+            raise ValueError(f"Pointer {hex(ptr)} was not allocated (or was already freed)")
+        self._free.setdefault(size_class, []).append(ptr)
+
+    def _allocated_after(self, ptr: int, mark: ArenaMark) -> bool:
+        for index, region in enumerate(self._regions):
+            if region.base <= ptr < region.end:
+                return index >= len(mark.ptrs) or ptr >= mark.ptrs[index]
+        return False
+
+    def mark(self) -> ArenaMark:
+        mark = ArenaMark(self._current, [region.ptr for region in self._regions])
+        self._marks.append(mark)
+        return mark
+
+    def reset(self, mark: ArenaMark):
+        """
+        Release everything allocated since the mark, the memory stays committed for the next allocations.
+        """
+        while self._marks and self._marks[-1] is not mark:
+            self._marks.pop()
+        assert self._marks, "Unknown arena mark"
+        self._marks.pop()
+        self._sizes = {ptr: size for ptr, size in self._sizes.items() if not self._allocated_after(ptr, mark)}
+        for size_class in self._free:
+            self._free[size_class] = [ptr for ptr in self._free[size_class] if not self._allocated_after(ptr, mark)]
+        for ptr, size_class in mark.reused:
+            if ptr in self._sizes:
+                del self._sizes[ptr]
+                self._free.setdefault(size_class, []).append(ptr)
+        for index, region in enumerate(self._regions):
+            region.ptr = mark.ptrs[index] if index < len(mark.ptrs) else region.base
+        self._current = mark.region
+
+    def has_mark(self, mark: ArenaMark) -> bool:
+        return any(m is mark for m in self._marks)
+
+    def snapshot(self):
+        regions = [replace(region) for region in self._regions]
+        # The mark objects are kept (the arena scopes reset them by identity), together with their state
+        marks = [(mark, mark.region, list(mark.ptrs), list(mark.reused)) for mark in self._marks]
+        free = {size_class: list(ptrs) for size_class, ptrs in self._free.items()}
+        return regions, self._current, free, dict(self._sizes), marks
+
+    def restore(self, snapshot):
+        regions, self._current, free, sizes, marks = snapshot
+        self._regions = [replace(region) for region in regions]
+        self._free = {size_class: list(ptrs) for size_class, ptrs in free.items()}
+        self._sizes = dict(sizes)
+        self._marks = []
+        for mark, region, ptrs, reused in marks:
+            mark.region, mark.ptrs, mark.reused = region, list(ptrs), list(reused)
+            self._marks.append(mark)
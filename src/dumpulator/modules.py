@@ -1,5 +1,6 @@
+import bisect
 from dataclasses import dataclass, field
-from typing import Dict, Optional, Union, List, Tuple
+from typing import Dict, Optional, Union, List, Tuple, Callable, Any
 
 import pefile
 from .memory import MemoryManager
@@ -12,53 +13,138 @@ class ModuleExport:
     name: str
     forward: Optional[Tuple[str, str]] = None
 
+@dataclass
+class ModuleTable:
+    """
+    The parts of the PE headers used by the emulator, this is what the export cache stores.
+    """
+    entry: int
+    section_alignment: int
+    # (name, rva, virtual size)
+    sections: List[Tuple[str, int, int]] = field(default_factory=list)
+    # (rva, ordinal, name, forward), forwarded exports have no rva. None until the export directory is parsed.
+    exports: Optional[List[Tuple[Optional[int], int, Optional[str], Optional[Tuple[str, str]]]]] = None
+
+    @staticmethod
+    def from_pe(pe: pefile.PE, exports=True) -> "ModuleTable":
+        table = ModuleTable(pe.OPTIONAL_HEADER.AddressOfEntryPoint, pe.OPTIONAL_HEADER.SectionAlignment)
+        for section in pe.sections:
+            name = section.Name.rstrip(b"\0").decode(encoding="ascii", errors="backslashreplace")
+            table.sections.append((name, section.VirtualAddress, section.Misc_VirtualSize))
+        if exports:
+            table.exports = ModuleTable.parse_exports(pe)
+        return table
+
+    @staticmethod
+    def parse_exports(pe: pefile.PE) -> List[Tuple[Optional[int], int, Optional[str], Optional[Tuple[str, str]]]]:
+        exports = []
+        pe.parse_data_directories(directories=[pefile.DIRECTORY_ENTRY["IMAGE_DIRECTORY_ENTRY_EXPORT"]])
+        pe_exports = pe.DIRECTORY_ENTRY_EXPORT.symbols if hasattr(pe, "DIRECTORY_ENTRY_EXPORT") else []
+        for pe_export in pe_exports:
+            if pe_export.name:
+                name = pe_export.name.decode("ascii")
+            else:
+                name = None
+
+            if pe_export.forwarder is not None:
+                forward = pe_export.forwarder.decode().split(".")
+                forward = (f"{forward[0].lower()}.dll", str(forward[1]))
+                exports.append((None, pe_export.ordinal, name, forward))
+            else:
+                exports.append((pe_export.address, pe_export.ordinal, name, None))
+        return exports
+
+    def to_json(self) -> Dict[str, Any]:
+        assert self.exports is not None
+        return {
+            "entry": self.entry,
+            "section_alignment": self.section_alignment,
+            "sections": self.sections,
+            "exports": self.exports,
+        }
+
+    @staticmethod
+    def from_json(data: Dict[str, Any]) -> "ModuleTable":
+        sections = [(name, rva, size) for name, rva, size in data["sections"]]
+        exports = []
+        for rva, ordinal, name, forward in data["exports"]:
+            exports.append((rva, ordinal, name, None if forward is None else (forward[0], forward[1])))
+        return ModuleTable(data["entry"], data["section_alignment"], sections, exports)
+
 @dataclass
 class Module:
-    pe: pefile.PE
+    _pe: Optional[pefile.PE]
     path: str  # TODO(printup): use pathlib.Path
     name: str = field(init=False)
-    exports: List[ModuleExport] = field(default_factory=list)
+    # The export indices are built on the first lookup
+    _exports: Optional[List[ModuleExport]] = None
     _exports_by_address: Dict[int, int] = field(default_factory=dict)
     _exports_by_ordinal: Dict[int, int] = field(default_factory=dict)
     _exports_by_name: Dict[str, int] = field(default_factory=dict)
-    base: int = field(init=False)
-    size: int = field(init=False)
+    # address -> "module:export" for the tracer, built on demand
+    _symbols: Optional[Dict[int, str]] = None
+    # Taken from the PE if there is one, otherwise they have to be passed
+    base: int = 0
+    size: int = 0
     entry: int = field(init=False)
+    table: Optional[ModuleTable] = None
+    # Creates the PE on first access when the module was loaded from the export cache
+    _pe_loader: Optional[Callable[[], pefile.PE]] = None
 
     def __post_init__(self):
         self.path = self.path.replace("/", "\\")
         self.name = self.path.split("\\")[-1]
-        self._parse_pe()
+        if self._pe is not None:
+            self.base = self._pe.OPTIONAL_HEADER.ImageBase
+            self.size = self._pe.OPTIONAL_HEADER.SizeOfImage
+            if self.table is None:
+                self.table = ModuleTable.from_pe(self._pe, exports=False)
+        assert self.table is not None, "A module needs either a PE or a table"
+        self.entry = self.base + self.table.entry
 
-    def _parse_pe(self):
-        self.base = self.pe.OPTIONAL_HEADER.ImageBase
-        self.size = self.pe.OPTIONAL_HEADER.SizeOfImage
-        self.entry = self.base + self.pe.OPTIONAL_HEADER.AddressOfEntryPoint
-        self.pe.parse_data_directories(directories=[pefile.DIRECTORY_ENTRY["IMAGE_DIRECTORY_ENTRY_EXPORT"]])
-        pe_exports = self.pe.DIRECTORY_ENTRY_EXPORT.symbols if hasattr(self.pe, "DIRECTORY_ENTRY_EXPORT") else []
+    @property
+    def pe(self) -> pefile.PE:
+        if self._pe is None:
+            assert self._pe_loader is not None
+            self._pe = self._pe_loader()
+        return self._pe
 
-        for pe_export in pe_exports:
-            if pe_export.name:
-                name = pe_export.name.decode("ascii")
-            else:
-                name = None
+    @property
+    def exports(self) -> List[ModuleExport]:
+        if self._exports is None:
+            self._load_exports()
+        return self._exports
 
-            if pe_export.forwarder is not None:
-                va = 0
-                forward = pe_export.forwarder.decode().split(".")
-                forward = (f"{forward[0].lower()}.dll", str(forward[1]))
-                export = ModuleExport(va, pe_export.ordinal, name, forward)
+    def _load_exports(self):
+        if self.table.exports is None:
+            self.table.exports = ModuleTable.parse_exports(self.pe)
+        exports: List[ModuleExport] = []
+        for rva, ordinal, name, forward in self.table.exports:
+            if forward is not None:
+                export = ModuleExport(0, ordinal, name, forward)
             else:
-                va = self.base + pe_export.address
-                export = ModuleExport(va, pe_export.ordinal, name)
+                export = ModuleExport(self.base + rva, ordinal, name)
 
-            self._exports_by_address[export.address] = len(self.exports)
-            self._exports_by_ordinal[export.ordinal] = len(self.exports)
+            self._exports_by_address[export.address] = len(exports)
+            self._exports_by_ordinal[export.ordinal] = len(exports)
             if name is not None:
-                self._exports_by_name[name] = len(self.exports)
-            self.exports.append(export)
+                self._exports_by_name[name] = len(exports)
+            exports.append(export)
+        self._exports = exports
+
+    def symbol(self, address: int) -> Optional[str]:
+        # Returns "module:export" if an export starts at the address
+        if self._symbols is None:
+            symbols: Dict[int, str] = {}
+            for export in self.exports:
+                name = export.name if export.name else f"#{export.ordinal}"
+                symbols[export.address] = f"{self.name}:{name}"
+            self._symbols = symbols
+        return self._symbols.get(address, None)
 
     def find_export(self, key: Union[str, int]):
+        if self._exports is None:
+            self._load_exports()
         if isinstance(key, int):
             index = self._exports_by_ordinal.get(key, None)
             if index is None:
@@ -88,9 +174,15 @@ class ModuleManager:
     _name_lookup: Dict[str, int] = field(default_factory=dict)
     _modules: Dict[int, Module] = field(default_factory=dict)
     main: int = 0
+    # Sorted module bases, used for the address lookup
+    _bases: List[int] = field(default_factory=list)
 
     def add(self, pe: pefile.PE, path: str):
-        module = Module(pe, path)
+        return self.add_module(Module(pe, path))
+
+    def add_module(self, module: Module):
+        if module.base not in self._modules:
+            bisect.insort(self._bases, module.base)
         self._modules[module.base] = module
         region = self._memory.find_region(module.base)
         assert region.start == module.base
@@ -103,9 +195,11 @@ class ModuleManager:
 
     def find(self, key: Union[str, int]) -> Optional[Module]:
         if isinstance(key, int):
-            region = self._memory.find_region(key)
-            if region is not None and isinstance(region.info, Module):
-                return region.info
+            index = bisect.bisect_right(self._bases, key)
+            if index > 0:
+                module = self._modules[self._bases[index - 1]]
+                if key in module:
+                    return module
             return None
         if isinstance(key, str):
             base = self._name_lookup.get(key, None)
@@ -140,3 +234,30 @@ class ModuleManager:
 
     def __repr__(self) -> str:
         return f"ModuleManager(main={hex(self.main)}, modules={len(self._modules)})"
+
+class ModuleSymbols:
+    """
+    Read-only address -> "module:export" mapping over all the modules, the per-module maps are built on demand.
+    """
+    def __init__(self, modules: ModuleManager):
+        self._modules = modules
+        self._last: Optional[Module] = None
+
+    def get(self, address: int, default=None):
+        module = self._last
+        if module is None or address not in module:
+            module = self._modules.find(address)
+            if module is None:
+                return default
+            self._last = module
+        symbol = module.symbol(address)
+        return default if symbol is None else symbol
+
+    def __getitem__(self, address: int) -> str:
+        symbol = self.get(address, None)
+        if symbol is None:
+            raise KeyError(address)
+        return symbol
+
+    def __contains__(self, address: int):
+        return self.get(address, None) is not None
@@ -1,5 +1,6 @@
 import ctypes
 import traceback
+from typing import Dict, List, Optional, Tuple
 
 from .ntenums import *
 from .ntprimitives import *
@@ -7,6 +8,10 @@ from .ntstructs import *
 
 # NTSTATUS
 STATUS_SUCCESS = 0
+STATUS_TIMEOUT = 0x102
+STATUS_BUFFER_OVERFLOW = 0x80000005
+STATUS_NO_MORE_ENTRIES = 0x8000001A
+STATUS_BUFFER_TOO_SMALL = 0xC0000023
 STATUS_NOT_IMPLEMENTED = 0xC0000002
 STATUS_ACCESS_VIOLATION = 0xC0000005
 STATUS_INVALID_HANDLE = 0xC0000008
@@ -247,105 +252,87 @@ class CONTEXT(ctypes.Structure):
     _mmx = ("Xmm0", "Xmm1", "Xmm2", "Xmm3", "Xmm4", "Xmm5", "Xmm6", "Xmm7",
             "Xmm8", "Xmm9", "Xmm10", "Xmm11", "Xmm12", "Xmm13", "Xmm14", "Xmm15")
 
+    # ContextFlags -> (field names, unicorn register ids) transferred in a single batch
+    _plans: Dict[int, Tuple[List[str], List[int]]] = {}
+
+    @staticmethod
+    def _plan(flags: int, regs) -> Tuple[List[str], List[int]]:
+        plan = CONTEXT._plans.get(flags, None)
+        if plan is None:
+            fields = []
+            if (flags & CONTEXT_CONTROL) == CONTEXT_CONTROL:
+                fields += CONTEXT._control
+            if (flags & CONTEXT_INTEGER) == CONTEXT_INTEGER:
+                fields += [key for key in CONTEXT._integer if key not in fields]
+            if (flags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS:
+                fields += CONTEXT._segments
+            if (flags & CONTEXT_DEBUG_REGISTERS) == CONTEXT_DEBUG_REGISTERS:
+                fields += [key for key in CONTEXT._debug if key.startswith("Dr")]
+            names = [key[3:].lower() if key.startswith("Seg") else key.lower() for key in fields]
+            plan = fields, [regs._resolve_reg(name) for name in names]
+            CONTEXT._plans[flags] = plan
+        return plan
+
+    # Like the per-register transfer this replaces, a register that fails is reported and skipped
+    @staticmethod
+    def _read_batch(regs, reg_ids: List[int]) -> List[Optional[int]]:
+        try:
+            return regs.read_batch(reg_ids)
+        except Exception:
+            traceback.print_exc()
+        values = []
+        for reg in reg_ids:
+            try:
+                values.append(regs.read_batch([reg])[0])
+            except Exception:
+                traceback.print_exc()
+                values.append(None)
+        return values
+
+    @staticmethod
+    def _write_batch(regs, values: List[Tuple[int, int]]):
+        try:
+            regs.write_batch(values)
+            return
+        except Exception:
+            traceback.print_exc()
+        for value in values:
+            try:
+                regs.write_batch([value])
+            except Exception:
+                traceback.print_exc()
+
     # Based on: https://github.com/MarioVilas/winappdbg/blob/master/winappdbg/win32/context_amd64.py#L424
     def from_regs(self, regs):
         setattr(self, "MxCsr", regs["mxcsr"])
         # TODO: implement high xmm support
         ContextFlags = self.ContextFlags
-        if (ContextFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL:
-            for key in CONTEXT._control:
-                try:
-                    dpname = key.lower()
-                    if key.startswith("Seg"):
-                        dpname = key[3:].lower()
-                    setattr(self, key, regs[dpname])
-                except Exception:
-                    traceback.print_exc()
-        if (ContextFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER:
-            for key in CONTEXT._integer:
-                try:
-                    setattr(self, key, regs[key.lower()])
-                except Exception:
-                    traceback.print_exc()
-        if (ContextFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS:
-            for key in CONTEXT._segments:
-                try:
-                    dpname = key.lower()
-                    if key.startswith("Seg"):
-                        dpname = key[3:].lower()
-                    setattr(self, key, regs[dpname])
-                except Exception:
-                    traceback.print_exc()
+        fields, reg_ids = CONTEXT._plan(ContextFlags, regs)
+        for key, value in zip(fields, CONTEXT._read_batch(regs, reg_ids)):
+            if value is not None:
+                setattr(self, key, value)
         if (ContextFlags & CONTEXT_DEBUG_REGISTERS) == CONTEXT_DEBUG_REGISTERS:
             for key in CONTEXT._debug:
-                try:
-                    value = regs[key.lower()] if key.startswith("Dr") else 0
-                    setattr(self, key, value)
-                except Exception:
-                    traceback.print_exc()
+                if not key.startswith("Dr"):
+                    setattr(self, key, 0)
         if (ContextFlags & CONTEXT_MMX_REGISTERS) == CONTEXT_MMX_REGISTERS:
+            # The 128-bit registers are not supported by the batch functions
             xmm = self.FltSave.Xmm
             for key in CONTEXT._mmx:
                 x = regs[key.lower()]
-                y = M128A()
+                y = getattr(xmm, key)
                 y.High = x >> 64
-                y.Low = x - (x >> 64)
-                try:
-                    setattr(xmm, key, y)
-                except Exception:
-                    traceback.print_exc()
+                y.Low = x & 0xFFFFFFFFFFFFFFFF
 
     def to_regs(self, regs):
-        setattr(self, "MxCsr", regs["mxcsr"])
         # TODO: implement high xmm support
         ContextFlags = self.ContextFlags
-        if (ContextFlags & CONTEXT_CONTROL) == CONTEXT_CONTROL:
-            for key in CONTEXT._control:
-                try:
-                    dpname = key.lower()
-                    if key.startswith("Seg"):
-                        dpname = key[3:].lower()
-                    setattr(regs, dpname, getattr(self, key))
-                except Exception:
-                    traceback.print_exc()
-        if (ContextFlags & CONTEXT_INTEGER) == CONTEXT_INTEGER:
-            for key in CONTEXT._integer:
-                try:
-                    setattr(regs, key.lower(), getattr(self, key))
-                except Exception:
-                    traceback.print_exc()
-        if (ContextFlags & CONTEXT_SEGMENTS) == CONTEXT_SEGMENTS:
-            for key in CONTEXT._segments:
-                try:
-                    dpname = key.lower()
-                    if key.startswith("Seg"):
-                        dpname = key[3:].lower()
-                    setattr(regs, dpname, getattr(self, key))
-                except Exception:
-                    traceback.print_exc()
-        if (ContextFlags & CONTEXT_DEBUG_REGISTERS) == CONTEXT_DEBUG_REGISTERS:
-            for key in CONTEXT._debug:
-                try:
-                    if key.startswith("Dr"):
-                        setattr(regs, key.lower(), getattr(self, key))
-                except Exception:
-                    traceback.print_exc()
+        fields, reg_ids = CONTEXT._plan(ContextFlags, regs)
+        CONTEXT._write_batch(regs, [(reg, getattr(self, key)) for key, reg in zip(fields, reg_ids)])
         if (ContextFlags & CONTEXT_MMX_REGISTERS) == CONTEXT_MMX_REGISTERS:
             # TODO implement
             pass
-            """
-            xmm = self.FltSave.Xmm
-            for key in CONTEXT._mmx:
-                x = regs[key.lower()]
-                y = M128A()
-                y.High = x >> 64
-                y.Low = x - (x >> 64)
-                try:
-                    setattr(xmm, key, y)
-                except Exception as x:
-                    traceback.print_exc()
-                    pass
-            """
+
 assert ctypes.sizeof(CONTEXT) == 0x4d0
 
 class EXCEPTION_RECORD64(ctypes.Structure):
@@ -404,60 +391,40 @@ class WOW64_CONTEXT(ctypes.Structure):
         ("ExtendedRegisters", ctypes.c_uint8 * 512),
     ]
 
+    _registers = ("Dr0", "Dr1", "Dr2", "Dr3", "Dr6", "Dr7",
+                  "Edi", "Esi", "Ebx", "Edx", "Ecx", "Eax", "Ebp", "Eip", "EFlags", "Esp")
+    _segments = ("SegCs", "SegSs", "SegDs", "SegEs", "SegFs", "SegGs")
+
+    # There are no ContextFlags in this structure, so the plans are per group of fields
+    _plans: Dict[Tuple[str, ...], Tuple[List[str], List[int]]] = {}
+
+    @staticmethod
+    def _plan(group: Tuple[str, ...], regs) -> Tuple[List[str], List[int]]:
+        plan = WOW64_CONTEXT._plans.get(group, None)
+        if plan is None:
+            fields = list(group)
+            names = [key[3:].lower() if key.startswith("Seg") else key.lower() for key in fields]
+            plan = fields, [regs._resolve_reg(name) for name in names]
+            WOW64_CONTEXT._plans[group] = plan
+        return plan
+
     def from_regs(self, regs):
         # TODO: implement properly
-        self.Dr0 = regs.dr0
-        self.Dr1 = regs.dr1
-        self.Dr2 = regs.dr2
-        self.Dr3 = regs.dr3
-        self.Dr6 = regs.dr6
-        self.Dr7 = regs.dr7
-        self.Edi = regs.edi
-        self.Esi = regs.esi
-        self.Ebx = regs.ebx
-        self.Edx = regs.edx
-        self.Ecx = regs.ecx
-        self.Eax = regs.eax
-        self.Ebp = regs.ebp
-        self.Eip = regs.eip
-        self.EFlags = regs.eflags
-        self.Esp = regs.esp
-
-        self.SegCs = regs.cs
-        self.SegSs = regs.ss
-        self.SegDs = regs.ds
-        self.SegEs = regs.es
-        self.SegFs = regs.fs
-        self.SegGs = regs.gs
+        fields, reg_ids = WOW64_CONTEXT._plan(WOW64_CONTEXT._registers + WOW64_CONTEXT._segments, regs)
+        for key, value in zip(fields, regs.read_batch(reg_ids)):
+            setattr(self, key, value)
 
         # TODO: implement xmm
 
     def to_regs(self, regs):
-        regs.dr0 = self.Dr0
-        regs.dr1 = self.Dr1
-        regs.dr2 = self.Dr2
-        regs.dr3 = self.Dr3
-        regs.dr6 = self.Dr6
-        regs.dr7 = self.Dr7
-        regs.edi = self.Edi
-        regs.esi = self.Esi
-        regs.ebx = self.Ebx
-        regs.edx = self.Edx
-        regs.ecx = self.Ecx
-        regs.eax = self.Eax
-        regs.ebp = self.Ebp
-        regs.eip = self.Eip
-        regs.eflags = self.EFlags
-        regs.esp = self.Esp
+        fields, reg_ids = WOW64_CONTEXT._plan(WOW64_CONTEXT._registers, regs)
+        regs.write_batch([(reg, getattr(self, key)) for key, reg in zip(fields, reg_ids)])
 
         # TODO: implement segment switching
         # NOTE: if you update fs/gs the fs_base/gs_base will be set to 0
-        assert regs.cs == self.SegCs & 0xFFFF
-        assert regs.ss == self.SegSs & 0xFFFF
-        assert regs.ds == self.SegDs & 0xFFFF
-        assert regs.es == self.SegEs & 0xFFFF
-        assert regs.fs == self.SegFs & 0xFFFF
-        assert regs.gs == self.SegGs & 0xFFFF
+        fields, reg_ids = WOW64_CONTEXT._plan(WOW64_CONTEXT._segments, regs)
+        for key, value in zip(fields, regs.read_batch(reg_ids)):
+            assert value == getattr(self, key) & 0xFFFF
 
         # TODO: implement xmm
 assert ctypes.sizeof(WOW64_CONTEXT) == 0x2cc
@@ -1,7 +1,9 @@
+import array
 import struct
 import ctypes
+import sys
 import typing
-from typing import Optional, Annotated, Generic, TypeVar, Type, Union, SupportsInt, SupportsBytes
+from typing import Optional, Annotated, Generic, TypeVar, Type, Union, SupportsInt, SupportsBytes, List, Tuple, Sequence
 from enum import Enum
 from dataclasses import dataclass
 
@@ -70,21 +72,112 @@ class Architecture:
     def write_ptr(self, addr: SupportsInt, value: int):
         self.write(addr, struct.pack("<Q" if self._x64 else "<I", value))
 
-    def read_str(self, addr: SupportsInt, encoding="utf-8") -> str:
-        # TODO: safely read the memory
-        data = self.read(addr, 512)
-
-        # Note: this is awful
-        if "-16" in encoding:
-            nullidx = data.find(b'\0\0')
-            if nullidx != -1:
-                nullidx += 1
-        else:
-            nullidx = data.find(b'\0')
-        if nullidx != -1:
-            data = data[:nullidx]
-
-        return data.decode(encoding)
+    def read_ptrs(self, addr: SupportsInt, count: int) -> array.array:
+        # Reads an array of pointers with a single memory access
+        values = array.array("Q" if self._x64 else "I")
+        assert values.itemsize == self.ptr_size()
+        values.frombytes(self.read(addr, count * values.itemsize))
+        if sys.byteorder != "little":
+            values.byteswap()
+        return values
+
+    def read_struct_array(self, addr: SupportsInt, struct_type: Type["Struct"], count: int) -> List["Struct"]:
+        # Reads count consecutive structures with a single memory access
+        addr = int(addr)
+        items = [struct_type(self) for _ in range(count)]
+        if count == 0:
+            return items
+        size = ctypes.sizeof(items[0]._ctype)
+        data = self.read(addr, size * count)
+        for i, item in enumerate(items):
+            item._ptr = addr + i * size
+            item._cself = item._ctype.from_buffer_copy(data, i * size)
+        return items
+
+    def read_many(self, ranges: Sequence[Tuple[SupportsInt, int]]) -> List[bytes]:
+        # Scatter-gather read, ranges that overlap or share a page are read once
+        results: List[bytes] = [b""] * len(ranges)
+        order = sorted(range(len(ranges)), key=lambda i: int(ranges[i][0]))
+        span_start = 0
+        span_end = 0
+        members: List[int] = []
+
+        def flush():
+            data = self.read(span_start, span_end - span_start)
+            for index in members:
+                offset = int(ranges[index][0]) - span_start
+                results[index] = bytes(data[offset:offset + ranges[index][1]])
+
+        for index in order:
+            addr, size = int(ranges[index][0]), ranges[index][1]
+            if members and (addr <= span_end or addr & ~0xFFF == (span_end - 1) & ~0xFFF):
+                span_end = max(span_end, addr + size)
+            else:
+                if members:
+                    flush()
+                span_start = addr
+                span_end = addr + size
+                members = []
+            members.append(index)
+        if members:
+            flush()
+        return results
+
+    def find_bytes(self, addr: SupportsInt, pattern: bytes, size: int) -> int:
+        # Returns the address of the first match in [addr, addr + size) or -1, stops at unreadable memory
+        addr = int(addr)
+        end = addr + size
+        data = b""
+        data_addr = addr
+        ptr = addr
+        while ptr < end:
+            chunk_size = min(0x1000 - (ptr & 0xFFF), end - ptr)
+            try:
+                chunk = self.read(ptr, chunk_size)
+            except IndexError:
+                return -1
+            # Keep the tail of the previous chunk for matches across the page boundary
+            keep = min(len(data), len(pattern) - 1)
+            data_addr = ptr - keep
+            data = data[len(data) - keep:] + bytes(chunk)
+            index = data.find(pattern)
+            if index != -1:
+                return data_addr + index
+            ptr += chunk_size
+        return -1
+
+    def strlen(self, addr: SupportsInt, char_size: int = 1, max_length: Optional[int] = None) -> int:
+        # Number of characters before the terminator, reading stops at unreadable memory or max_length
+        addr = int(addr)
+        terminator = bytes(char_size)
+        data = bytearray()
+        ptr = addr
+        search = 0
+        while max_length is None or len(data) < max_length * char_size:
+            try:
+                data += self.read(ptr, 0x1000 - (ptr & 0xFFF))
+            except IndexError:
+                if ptr == addr:
+                    raise
+                break
+            ptr = (ptr & ~0xFFF) + 0x1000
+            while True:
+                index = data.find(terminator, search)
+                if index == -1:
+                    # The terminator can cross the page boundary
+                    search = max(0, len(data) - char_size + 1)
+                    break
+                if index % char_size == 0:
+                    length = index // char_size
+                    return length if max_length is None else min(length, max_length)
+                search = index + 1
+        length = len(data) // char_size
+        return length if max_length is None else min(length, max_length)
+
+    def read_str(self, addr: SupportsInt, encoding="utf-8", max_length=0x10000) -> str:
+        char_size = 2 if "-16" in encoding else 1
+        length = self.strlen(addr, char_size, max_length)
+        return bytes(self.read(addr, length * char_size)).decode(encoding)
 
 T = TypeVar("T")
 
@@ -161,6 +254,19 @@ class P(Generic[T]):
     def deref(self) -> T:
         return self[0]
 
+    def read_array(self, count: int) -> List[T]:
+        # Same as [self[i] for i in range(count)] with a single memory access
+        ptype = self.type
+        if ptype is None:
+            raise TypeError(f"No type associated with pointer")
+        if P.is_ptr(ptype):
+            return [ptype(self.arch, ptr) for ptr in self.arch.read_ptrs(self.ptr, count)]
+        if issubclass(ptype, Struct):
+            return self.arch.read_struct_array(self.ptr, ptype, count)
+        ctype = Struct.translate_ctype(self.arch.ptr_type(), ptype)
+        data = self.arch.read(self.ptr, ctypes.sizeof(ctype) * count)
+        return [ptype(value) for value in (ctype * count).from_buffer_copy(data)]
+
     def __int__(self):
         return self.ptr
 
@@ -1289,15 +1289,24 @@ def ZwCreateThreadEx(dp: Dumpulator,
     assert DesiredAccess == 0x1fffff
     assert ObjectAttributes == 0
     assert ProcessHandle == dp.NtCurrentProcess()
-    assert CreateFlags == 0
+    # THREAD_CREATE_FLAGS_CREATE_SUSPENDED
+    assert CreateFlags & ~1 == 0
     assert ZeroBits == 0
-    assert StackSize == 0
-    assert MaximumStackSize == 0
-    # TODO: sanity check AttributeList
-    thread = ThreadObject(StartRoutine.ptr, Argument.ptr)
+    # NOTE: the requested stack sizes are ignored, every thread gets Scheduler.stack_size
+    thread = dp.scheduler.create_thread(StartRoutine.ptr, Argument.ptr, suspended=CreateFlags & 1 != 0)
     handle = dp.handles.new(thread)
     print(f"Started new thread {thread}, handle: {hex(handle)}")
     dp.write_ptr(ThreadHandle, handle)
+    if AttributeList != 0:
+        # PS_ATTRIBUTE_LIST: TotalLength followed by PS_ATTRIBUTE { Attribute, Size, ValuePtr, ReturnLength }
+        ptr_size = dp.ptr_size()
+        total_length = dp.read_ptr(AttributeList.ptr)
+        PS_ATTRIBUTE_CLIENT_ID = 0x10003
+        for attribute in range(AttributeList.ptr + ptr_size, AttributeList.ptr + total_length, 4 * ptr_size):
+            if dp.read_ptr(attribute) == PS_ATTRIBUTE_CLIENT_ID:
+                client_id = dp.read_ptr(attribute + 2 * ptr_size)
+                dp.write_ptr(client_id, dp.process_id)
+                dp.write_ptr(client_id + ptr_size, thread.thread_id)
     return STATUS_SUCCESS
 
 @syscall
@@ -1476,7 +1485,8 @@ def ZwDelayExecution(dp: Dumpulator,
                      Alertable: Annotated[BOOLEAN, SAL("_In_")],
                      DelayInterval: Annotated[P[LARGE_INTEGER], SAL("_In_opt_")]
                      ):
-    return STATUS_SUCCESS
+    # There is no clock, a delay lets the other threads run
+    return dp.scheduler.yield_execution(STATUS_SUCCESS)
 
 @syscall
 def ZwDeleteAtom(dp: Dumpulator,
@@ -1658,7 +1668,13 @@ def ZwEnumerateKey(dp: Dumpulator,
                    Length: Annotated[ULONG, SAL("_In_")],
                    ResultLength: Annotated[P[ULONG], SAL("_Out_")]
                    ):
-    raise NotImplementedError()
+    key = _registry_key(dp, KeyHandle)
+    if key is None:
+        return STATUS_INVALID_HANDLE
+    subkey = key.subkey(Index)
+    if subkey is None:
+        return STATUS_NO_MORE_ENTRIES
+    return _write_registry_info(dp, _key_information(subkey, KeyInformationClass), KeyInformation, Length, ResultLength)
 
 @syscall
 def ZwEnumerateSystemEnvironmentValuesEx(dp: Dumpulator,
@@ -1687,7 +1703,14 @@ def ZwEnumerateValueKey(dp: Dumpulator,
                         Length: Annotated[ULONG, SAL("_In_")],
                         ResultLength: Annotated[P[ULONG], SAL("_Out_")]
                         ):
-    raise NotImplementedError()
+    key = _registry_key(dp, KeyHandle)
+    if key is None:
+        return STATUS_INVALID_HANDLE
+    value = key.value_at(Index)
+    if value is None:
+        return STATUS_NO_MORE_ENTRIES
+    info = _key_value_information(value, KeyValueInformationClass)
+    return _write_registry_info(dp, info, KeyValueInformation, Length, ResultLength)
 
 @syscall
 def ZwExtendSection(dp: Dumpulator,
@@ -2399,10 +2422,17 @@ def ZwOpenKey(dp: Dumpulator,
               DesiredAccess: Annotated[ACCESS_MASK, SAL("_In_")],
               ObjectAttributes: Annotated[P[OBJECT_ATTRIBUTES], SAL("_In_")]
               ):
-    key_name = ObjectAttributes[0].ObjectName[0].read_str()
-    assert DesiredAccess == 0x20019
+    attributes = ObjectAttributes[0]
+    key_name = attributes.ObjectName[0].read_str()
+    if attributes.RootDirectory != 0:
+        root = _registry_key(dp, attributes.RootDirectory)
+        if root is None:
+            return STATUS_INVALID_HANDLE
+        key_name = root.path + "\\" + key_name
     handle = dp.handles.open_file(key_name)
-    assert handle is not None
+    if handle is None:
+        dp.info(f"key not found: {key_name}")
+        return STATUS_OBJECT_NAME_NOT_FOUND
     KeyHandle.write_ptr(handle)
     return STATUS_SUCCESS
 
@@ -2916,7 +2946,7 @@ def ZwQueryInformationFile(dp: Dumpulator,
 
             # https://docs.microsoft.com/en-us/openspecs/windows_protocols/ms-fscc/5afa7f66-619c-48f3-955f-68c4ece704ae
             # return FILE_STANDARD_INFORMATION
-            end_of_file = 0 if file.data is None else len(file.data)
+            end_of_file = file.size
             alloc_size = end_of_file + (end_of_file % 0x1000)
             number_of_links = 1
             delete_pending = 0
@@ -3161,7 +3191,10 @@ def ZwQueryKey(dp: Dumpulator,
                Length: Annotated[ULONG, SAL("_In_")],
                ResultLength: Annotated[P[ULONG], SAL("_Out_")]
                ):
-    raise NotImplementedError()
+    key = _registry_key(dp, KeyHandle)
+    if key is None:
+        return STATUS_INVALID_HANDLE
+    return _write_registry_info(dp, _key_information(key, KeyInformationClass), KeyInformation, Length, ResultLength)
 
 @syscall
 def ZwQueryLicenseValue(dp: Dumpulator,
@@ -3370,50 +3403,89 @@ def ZwQueryValueKey(dp: Dumpulator,
                     Length: Annotated[ULONG, SAL("_In_")],
                     ResultLength: Annotated[P[ULONG], SAL("_Out_")]
                     ):
-    key = dp.handles.get(KeyHandle, RegistryKeyObject)
+    key = _registry_key(dp, KeyHandle)
+    if key is None:
+        return STATUS_INVALID_HANDLE
     name = ValueName[0].read_str()
-    if KeyValueInformationClass == KEY_VALUE_INFORMATION_CLASS.KeyValueFullInformation:
-        value = key.values.get(name.lower(), None)
-        assert value is not None, "value not found"
+    value = key.value(name)
+    if value is None:
+        dp.info(f"value not found: {key.path}\\{name}")
+        return STATUS_OBJECT_NAME_NOT_FOUND
+    info = _key_value_information(value, KeyValueInformationClass)
+    return _write_registry_info(dp, info, KeyValueInformation, Length, ResultLength)
+
+def _registry_key(dp: Dumpulator, handle: int):
+    key = dp.handles.get(handle, RegistryKeyObject)
+    if key is None:
+        return None
+    if key.node is None:
+        # Handle from the dump, look it up in case the key was added to the registry
+        key.node = dp.handles.registry.find(key.key)
+        if key.node is None:
+            raise NotImplementedError(f"registry key {key.key} is not in the registry")
+    return key.node
+
+def _key_information(key, KeyInformationClass: KEY_INFORMATION_CLASS):
+    # Returns (fixed size, data) of the KEY_*_INFORMATION structure
+    name = key.name.encode("utf-16-le")
+    if KeyInformationClass == KEY_INFORMATION_CLASS.KeyBasicInformation:
+        # LastWriteTime, TitleIndex, NameLength
+        header = struct.pack("<QII", 0, 0, len(name))
+        return len(header), header + name
+    elif KeyInformationClass == KEY_INFORMATION_CLASS.KeyNodeInformation:
+        # LastWriteTime, TitleIndex, ClassOffset, ClassLength, NameLength
+        header = struct.pack("<QIIII", 0, 0, 0xFFFFFFFF, 0, len(name))
+        return len(header), header + name
+    elif KeyInformationClass == KEY_INFORMATION_CLASS.KeyFullInformation:
+        children = key.children.values()
+        values = key.values.values()
+        max_name = max((len(child.name) * 2 for child in children), default=0)
+        max_value_name = max((len(value.name) * 2 for value in values), default=0)
+        max_value_data = max((len(value.data) for value in values), default=0)
+        # LastWriteTime, TitleIndex, ClassOffset, ClassLength, SubKeys, MaxNameLen, MaxClassLen, Values,
+        # MaxValueNameLen, MaxValueDataLen
+        header = struct.pack("<QIIIIIIIIII", 0, 0, 0xFFFFFFFF, 0, len(key.children), max_name, 0, len(key.values), max_value_name, max_value_data)
+        return len(header), header
+    raise NotImplementedError()
+
+def _key_value_information(value, KeyValueInformationClass: KEY_VALUE_INFORMATION_CLASS):
+    # Returns (fixed size, data) of the KEY_VALUE_*_INFORMATION structure
+    name = value.name.encode("utf-16-le")
+    if KeyValueInformationClass == KEY_VALUE_INFORMATION_CLASS.KeyValueBasicInformation:
+        # TitleIndex, Type, NameLength
+        header = struct.pack("<III", 0, value.type, len(name))
+        return len(header), header + name
+    elif KeyValueInformationClass == KEY_VALUE_INFORMATION_CLASS.KeyValueFullInformation:
+        header_size = ctypes.sizeof(KEY_VALUE_FULL_INFORMATION)
+        # The data is aligned to 4 bytes
+        data_offset = (header_size + len(name) + 3) & ~3
         info = KEY_VALUE_FULL_INFORMATION()
         info.TitleIndex = 0
-
-        if len(name) == 0:
-            info.NameLength = 0
-            appended_data = b""
-        else:
-            name_data = name.encode("utf-16-le")
-            info.NameLength = len(name_data)
-            appended_data = name_data
-
-        # Align to 4 bytes
-        remain = 4 - len(appended_data) % 4
-        if remain > 0:
-            appended_data += b"\0" * remain
-            assert (len(appended_data) % 4) == 0
-
-        if isinstance(value, str):
-            info.Type = REG_SZ
-            value_data = value.encode("utf-16-le") + b"\0\0"
-        elif isinstance(value, int):
-            info.Type = REG_DWORD
-            value_data = struct.pack("<I", value)
-        else:
-            raise NotImplementedError()
-
-        info.DataLength = len(value_data)
-        info.DataOffset = ctypes.sizeof(info) + len(appended_data)
-        appended_data += value_data
-
-        final_data = bytes(info) + appended_data
-        assert len(final_data) <= Length
-        if ResultLength != 0:
-            dp.write_ulong(ResultLength, len(final_data))
-        KeyValueInformation.write(final_data)
-
-        return STATUS_SUCCESS
-
-    raise NotImplementedError()
+        info.Type = value.type
+        info.DataOffset = data_offset
+        info.DataLength = len(value.data)
+        info.NameLength = len(name)
+        result = bytes(info) + name
+        result += b"\0" * (data_offset - len(result)) + value.data
+        return header_size, result
+    elif KeyValueInformationClass == KEY_VALUE_INFORMATION_CLASS.KeyValuePartialInformation:
+        # TitleIndex, Type, DataLength
+        header = struct.pack("<III", 0, value.type, len(value.data))
+        return len(header), header + value.data
+    raise NotImplementedError()
+
+def _write_registry_info(dp: Dumpulator, info, Information: PVOID, Length: int, ResultLength: P[ULONG]):
+    header_size, data = info
+    if ResultLength != 0:
+        dp.write_ulong(ResultLength, len(data))
+    if Length < header_size:
+        return STATUS_BUFFER_TOO_SMALL
+    if Length < len(data):
+        # Only the fixed part is returned
+        Information.write(data[:header_size])
+        return STATUS_BUFFER_OVERFLOW
+    Information.write(data)
+    return STATUS_SUCCESS
 
 @syscall
 def ZwQueryVirtualMemory(dp: Dumpulator,
@@ -3596,16 +3668,12 @@ def ZwReadFile(dp: Dumpulator,
         assert Buffer != 0
 
         file = dp.handles.get(FileHandle, AbstractFileObject)
-        buffer = file.read(Length)
-
-        print(f"reading {file.path}: {buffer}")
-
-        assert len(buffer) <= Length
-
-        Buffer.write(buffer)
+        read_size = file.read_into(dp, Buffer.ptr, Length)
+        assert read_size <= Length
+        dp.info(f"reading {file.path}: {hex(read_size)} bytes")
 
         dp.write_ptr(IoStatusBlock.ptr, STATUS_SUCCESS)
-        dp.write_ptr(IoStatusBlock.ptr + dp.ptr_size(), len(buffer))
+        dp.write_ptr(IoStatusBlock.ptr + dp.ptr_size(), read_size)
 
         return STATUS_SUCCESS
 
@@ -3840,7 +3908,7 @@ def ZwResetEvent(dp: Dumpulator,
                  EventHandle: Annotated[HANDLE, SAL("_In_")],
                  PreviousState: Annotated[P[LONG], SAL("_Out_opt_")]
                  ):
-    raise NotImplementedError()
+    return _set_event_state(dp, EventHandle, PreviousState, False)
 
 @syscall
 def ZwResetWriteWatch(dp: Dumpulator,
@@ -3869,7 +3937,13 @@ def ZwResumeThread(dp: Dumpulator,
                    ThreadHandle: Annotated[HANDLE, SAL("_In_")],
                    PreviousSuspendCount: Annotated[P[ULONG], SAL("_Out_opt_")]
                    ):
-    raise NotImplementedError()
+    thread = _wait_object(dp, ThreadHandle)
+    if not isinstance(thread, ThreadObject):
+        return STATUS_INVALID_HANDLE
+    resumed = dp.scheduler.resume(thread)
+    if PreviousSuspendCount != 0:
+        PreviousSuspendCount.write_ulong(1 if resumed else 0)
+    return STATUS_SUCCESS
 
 @syscall
 def ZwRevertContainerImpersonation(dp: Dumpulator
@@ -4025,6 +4099,20 @@ def ZwSetEvent(dp: Dumpulator,
                EventHandle: Annotated[HANDLE, SAL("_In_")],
                PreviousState: Annotated[P[LONG], SAL("_Out_opt_")]
                ):
+    return _set_event_state(dp, EventHandle, PreviousState, True)
+
+def _set_event_state(dp: Dumpulator, handle: int, previous_state: P, signalled: bool):
+    event = dp.handles.get(handle, None)
+    if event is None:
+        # Events created before the dump was taken are not tracked
+        return STATUS_SUCCESS
+    if not isinstance(event, EventObject):
+        return STATUS_INVALID_HANDLE
+    if previous_state != 0:
+        previous_state.write_ulong(1 if event.signalled else 0)
+    event.signalled = signalled
+    if signalled:
+        dp.scheduler.signal()
     return STATUS_SUCCESS
 
 @syscall
@@ -4536,8 +4624,12 @@ def ZwTerminateThread(dp: Dumpulator,
                       ThreadHandle: Annotated[HANDLE, SAL("_In_opt_")],
                       ExitStatus: Annotated[NTSTATUS, SAL("_In_")]
                       ):
-    assert ThreadHandle == dp.NtCurrentThread()
-    raise NotImplementedError()
+    thread = dp.scheduler.current.obj if ThreadHandle == 0 else _wait_object(dp, ThreadHandle)
+    if not isinstance(thread, ThreadObject):
+        return STATUS_INVALID_HANDLE
+    result = dp.scheduler.terminate(thread, ExitStatus)
+    # The result is an exception when the current thread terminated
+    return STATUS_SUCCESS if result is None else result
 
 @syscall
 def ZwTestAlert(dp: Dumpulator
@@ -4707,7 +4799,8 @@ def ZwWaitForMultipleObjects(dp: Dumpulator,
                              Alertable: Annotated[BOOLEAN, SAL("_In_")],
                              Timeout: Annotated[P[LARGE_INTEGER], SAL("_In_opt_")]
                              ):
-    raise NotImplementedError()
+    handles = [dp.read_ptr(Handles.ptr + i * dp.ptr_size()) for i in range(Count)]
+    return _wait_for_objects(dp, handles, WaitType == WAIT_TYPE.WaitAll, Timeout)
 
 @syscall
 def ZwWaitForMultipleObjects32(dp: Dumpulator,
@@ -4717,7 +4810,8 @@ def ZwWaitForMultipleObjects32(dp: Dumpulator,
                                Alertable: Annotated[BOOLEAN, SAL("_In_")],
                                Timeout: Annotated[P[LARGE_INTEGER], SAL("_In_opt_")]
                                ):
-    raise NotImplementedError()
+    handles = [dp.read_ulong(Handles.ptr + i * 4) for i in range(Count)]
+    return _wait_for_objects(dp, handles, WaitType == WAIT_TYPE.WaitAll, Timeout)
 
 @syscall
 def ZwWaitForSingleObject(dp: Dumpulator,
@@ -4725,7 +4819,23 @@ def ZwWaitForSingleObject(dp: Dumpulator,
                           Alertable: Annotated[BOOLEAN, SAL("_In_")],
                           Timeout: Annotated[P[LARGE_INTEGER], SAL("_In_opt_")]
                           ):
-    raise NotImplementedError()
+    return _wait_for_objects(dp, [Handle], False, Timeout)
+
+def _wait_object(dp: Dumpulator, handle: int):
+    if handle & dp.addr_mask == dp.NtCurrentThread():
+        return dp.scheduler.current.obj
+    return dp.handles.get(handle, None)
+
+def _wait_for_objects(dp: Dumpulator, handles: List[int], wait_all: bool, timeout: P):
+    objects = []
+    for handle in handles:
+        obj = _wait_object(dp, handle)
+        if obj is None:
+            return STATUS_INVALID_HANDLE
+        objects.append(obj)
+    # The value of the timeout does not matter, only whether there is one
+    timeout_value = None if timeout == 0 else struct.unpack("<q", dp.read(timeout.ptr, 8))[0]
+    return dp.scheduler.wait(objects, wait_all, timeout_value)
 
 @syscall
 def ZwWaitForWorkViaWorkerFactory(dp: Dumpulator,
@@ -4783,9 +4893,9 @@ def ZwWriteFile(dp: Dumpulator,
         assert Buffer != 0
 
         file = dp.handles.get(FileHandle, AbstractFileObject)
-        buffer = bytes(Buffer.read(Length))
+        buffer = Buffer.read(Length)
 
-        print(f"writing {file.path}: {buffer}")
+        dp.info(f"writing {file.path}: {hex(len(buffer))} bytes")
         file.write(buffer, Length)
 
         dp.write_ptr(IoStatusBlock.ptr, STATUS_SUCCESS)
@@ -4833,5 +4943,5 @@ def ZwWriteVirtualMemory(dp: Dumpulator,
 @syscall
 def ZwYieldExecution(dp: Dumpulator
                      ):
-    raise NotImplementedError()
+    return dp.scheduler.yield_execution(STATUS_SUCCESS)
 
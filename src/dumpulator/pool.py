@@ -0,0 +1,128 @@
+import multiprocessing
+import os
+from typing import Any, Callable, Iterable, Iterator, List, Optional, Union
+
+from .dumpulator import Dumpulator
+
+# The emulator of the worker process and the snapshot every task starts from
+_worker_dp: Optional[Dumpulator] = None
+_worker_snapshot = None
+
+def _init_worker(dp: Optional[Dumpulator], minidump_file: Optional[str], kwargs: dict, setup: Optional[Callable]):
+    global _worker_dp, _worker_snapshot
+    if dp is None:
+        # Without fork every worker loads the dump itself
+        dp = Dumpulator(minidump_file, **kwargs)
+        if setup is not None:
+            setup(dp)
+    _worker_dp = dp
+    _worker_snapshot = dp.snapshot()
+
+def _run_task(task):
+    target, item, result = task
+    dp = _worker_dp
+    try:
+        if not isinstance(target, int):
+            return target(dp, item)
+        args = []
+        for arg in item:
+            if isinstance(arg, str):
+                arg = arg.encode("utf-8") + b"\0"
+            if isinstance(arg, (bytes, bytearray)):
+                ptr = dp.allocate(max(len(arg), 1))
+                dp.write(ptr, arg)
+                args.append(ptr)
+            else:
+                args.append(int(arg))
+        value = dp.call(target, args)
+        if result is not None:
+            return result(dp, value, args)
+        return value
+    finally:
+        dp.restore(_worker_snapshot)
+
+class DumpulatorPool:
+    """
+    Runs calls into a dump in parallel over worker processes. Where fork is available the emulator is set up once
+    (with setup(dp)) and every worker starts from a copy-on-write clone of it, otherwise each worker loads the dump
+    and runs setup itself. Every task runs from a snapshot of the emulator after setup.
+
+    The targets, setup and result callbacks have to be picklable (module-level functions, not lambdas).
+    """
+    def __init__(self, minidump: Union[str, Dumpulator], workers: Optional[int] = None, setup: Optional[Callable[[Dumpulator], Any]] = None, **kwargs):
+        kwargs.setdefault("quiet", True)
+        self.workers = workers or os.cpu_count() or 1
+        # The emulator is closed with the pool when the pool created it
+        self._owns_dp = not isinstance(minidump, Dumpulator)
+        if "fork" in multiprocessing.get_all_start_methods():
+            if isinstance(minidump, Dumpulator):
+                dp = minidump
+            else:
+                dp = Dumpulator(minidump, **kwargs)
+            if setup is not None:
+                setup(dp)
+            # A fork while the prefetch thread holds its lock would deadlock the workers
+            if getattr(dp, "_prefetcher", None) is not None:
+                dp._prefetcher.wait()
+            self.dp = dp
+            context = multiprocessing.get_context("fork")
+            initargs = (dp, None, None, None)
+        else:
+            if isinstance(minidump, Dumpulator):
+                raise ValueError("An existing Dumpulator can only be shared with fork, pass the path of the dump instead")
+            self.dp = None
+            context = multiprocessing.get_context("spawn")
+            initargs = (None, minidump, kwargs, setup)
+        self._pool = context.Pool(self.workers, _init_worker, initargs)
+
+    def _tasks(self, target, items, result):
+        if not isinstance(target, int) and not callable(target):
+            target = int(target)
+        return [(target, item, result) for item in items]
+
+    def _chunksize(self, count: int, chunksize: Optional[int]):
+        # Batch the tasks to amortize the pickling, but keep enough chunks to balance the workers
+        if chunksize is None:
+            chunksize = max(1, count // (self.workers * 4))
+        return chunksize
+
+    def map(self, target: Union[int, Callable[[Dumpulator, Any], Any]], items: Iterable[Any], *, result: Optional[Callable[[Dumpulator, int, List[int]], Any]] = None, chunksize: Optional[int] = None) -> List[Any]:
+        """
+        When target is an address, every item is the list of arguments for dp.call(target, ...). Bytes and str
+        arguments are written to memory from dp.allocate() and passed as pointers. The return value of the call is
+        returned, or result(dp, return_value, args) when passed (for example to read an output buffer).
+        When target is a function target(dp, item) is called for every item instead. The results are in the order
+        of the items.
+        """
+        tasks = self._tasks(target, items, result)
+        return self._pool.map(_run_task, tasks, self._chunksize(len(tasks), chunksize))
+
+    def imap(self, target, items: Iterable[Any], *, result=None, chunksize: Optional[int] = None) -> Iterator[Any]:
+        """
+        Like map, but returns an iterator that yields the results (in order) while the tasks are still running.
+        """
+        tasks = self._tasks(target, items, result)
+        return self._pool.imap(_run_task, tasks, self._chunksize(len(tasks), chunksize))
+
+    def close(self):
+        self._pool.close()
+        self._pool.join()
+        self._close_dp()
+
+    def terminate(self):
+        self._pool.terminate()
+        self._pool.join()
+        self._close_dp()
+
+    def _close_dp(self):
+        if self.dp is not None and self._owns_dp:
+            self.dp.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        if exc_type is None:
+            self.close()
+        else:
+            self.terminate()
@@ -0,0 +1,132 @@
+import json
+from dataclasses import dataclass
+from typing import Any, Callable, Dict, Optional
+
+@dataclass
+class ProfileCounter:
+    count: int = 0
+    # Seconds
+    total: float = 0.0
+    max: float = 0.0
+
+    def add(self, elapsed: float):
+        self.count += 1
+        self.total += elapsed
+        if elapsed > self.max:
+            self.max = elapsed
+
+@dataclass
+class ModuleCounter:
+    blocks: int = 0
+    instructions: int = 0
+
+# Time spent in these categories is spent inside emu_start, the rest of emu_start is the emulated code itself
+HOOK_CATEGORIES = ["syscall", "lazy page", "write fault"]
+
+class Profiler:
+    """
+    Opt-in accounting of where the emulation time goes (Dumpulator(..., profile=True)). The hooks record the count
+    and duration of every syscall (by name), lazy page commit, write fault, exception round trip and emulation
+    restart. A block hook counts the executed blocks and instructions per module.
+    """
+    def __init__(self):
+        self.counters: Dict[str, Dict[str, ProfileCounter]] = {}
+        self.modules: Dict[str, ModuleCounter] = {}
+        # block address -> (module counter, instruction count)
+        self._blocks: Dict[int, tuple] = {}
+
+    def add(self, category: str, name: str, elapsed: float):
+        counters = self.counters.get(category, None)
+        if counters is None:
+            counters = self.counters[category] = {}
+        counter = counters.get(name, None)
+        if counter is None:
+            counter = counters[name] = ProfileCounter()
+        counter.add(elapsed)
+
+    def block(self, address: int, module_name: Callable[[int], str], instruction_count: Callable[[int], int]):
+        # The lookups are only done the first time a block executes
+        entry = self._blocks.get(address, None)
+        if entry is None:
+            name = module_name(address)
+            counter = self.modules.get(name, None)
+            if counter is None:
+                counter = self.modules[name] = ModuleCounter()
+            entry = self._blocks[address] = (counter, instruction_count(address))
+        counter, icount = entry
+        counter.blocks += 1
+        counter.instructions += icount
+
+    def invalidate_blocks(self):
+        # Called when the code can change (snapshot restore), the instruction counts are looked up again
+        self._blocks.clear()
+
+    def reset(self):
+        self.counters.clear()
+        self.modules.clear()
+        self._blocks.clear()
+
+    def total(self, category: str) -> ProfileCounter:
+        result = ProfileCounter()
+        for counter in self.counters.get(category, {}).values():
+            result.count += counter.count
+            result.total += counter.total
+            result.max = max(result.max, counter.max)
+        return result
+
+    def summary(self) -> Dict[str, float]:
+        emulation = self.total("emulation").total
+        hooks = sum(self.total(category).total for category in HOOK_CATEGORIES)
+        return {
+            "emulation": emulation,
+            "hooks": hooks,
+            "cpu": max(0.0, emulation - hooks),
+            "exception": self.total("exception").total,
+        }
+
+    def to_json(self, handles: Optional[Dict[str, Any]] = None) -> Dict[str, Any]:
+        return {
+            "summary": self.summary(),
+            "handles": handles,
+            "counters": {
+                category: {name: vars(counter) for name, counter in counters.items()}
+                for category, counters in self.counters.items()
+            },
+            "modules": {name: vars(counter) for name, counter in self.modules.items()},
+        }
+
+    def dump(self, path: str, handles: Optional[Dict[str, Any]] = None):
+        with open(path, "w") as f:
+            json.dump(self.to_json(handles), f, indent=2)
+
+    def report(self, top: Optional[int] = 20, handles: Optional[Dict[str, Any]] = None) -> str:
+        """
+        Text report, handles are the HandleManager statistics.
+        """
+        lines = []
+        summary = self.summary()
+        lines.append("summary:")
+        lines.append(f"  emu_start            {summary['emulation']*1000:10.1f}ms")
+        lines.append(f"    hooks              {summary['hooks']*1000:10.1f}ms (syscalls, pages)")
+        lines.append(f"    emulated code      {summary['cpu']*1000:10.1f}ms")
+        lines.append(f"  exception handling   {summary['exception']*1000:10.1f}ms")
+        for category, counters in self.counters.items():
+            lines.append(f"{category}:")
+            ordered = sorted(counters.items(), key=lambda item: item[1].total, reverse=True)
+            for name, counter in ordered[:top]:
+                average = counter.total / counter.count * 1000000
+                lines.append(f"  {name:<40} {counter.count:8} {counter.total*1000:10.1f}ms {average:10.1f}us/call {counter.max*1000:8.1f}ms max")
+            if top is not None and len(ordered) > top:
+                lines.append(f"  ... {len(ordered) - top} more")
+        if self.modules:
+            lines.append("modules:")
+            total = sum(counter.instructions for counter in self.modules.values()) or 1
+            ordered = sorted(self.modules.items(), key=lambda item: item[1].instructions, reverse=True)
+            for name, counter in ordered[:top]:
+                lines.append(f"  {name:<40} {counter.instructions:12} instructions {counter.instructions*100/total:5.1f}% {counter.blocks:10} blocks")
+        if handles is not None:
+            lines.append("handles:")
+            lines.append(f"  created {handles['created']}, closed {handles['closed']}, open {handles['open']}, peak {handles['peak']}")
+            for name, count in handles["open_by_type"].items():
+                lines.append(f"  {name:<40} {count:8} open")
+        return "\n".join(lines)
@@ -0,0 +1,273 @@
+import re
+import struct
+import sys
+from typing import Any, Dict, Iterator, List, NamedTuple, Optional, Tuple
+
+from .native import *
+
+class RegistryValue(NamedTuple):
+    name: str
+    type: int
+    data: bytes
+
+    @staticmethod
+    def from_python(name: str, value: Any) -> "RegistryValue":
+        if isinstance(value, RegistryValue):
+            return RegistryValue(name, value.type, value.data)
+        if isinstance(value, str):
+            return RegistryValue(name, REG_SZ, value.encode("utf-16-le") + b"\0\0")
+        if isinstance(value, int):
+            return RegistryValue(name, REG_DWORD, struct.pack("<I", value))
+        if isinstance(value, (bytes, bytearray)):
+            return RegistryValue(name, REG_BINARY, bytes(value))
+        if isinstance(value, list):
+            data = b"".join(s.encode("utf-16-le") + b"\0\0" for s in value) + b"\0\0"
+            return RegistryValue(name, REG_MULTI_SZ, data)
+        raise TypeError(f"Unsupported registry value type {type(value).__name__}")
+
+def _fold(name: str) -> str:
+    # Key and value names are compared case-insensitively, the folded names are shared between the keys
+    return sys.intern(name.lower())
+
+class RegistryKey:
+    """
+    Node in the registry trie. The children and values are indexed by their case-folded name. Keys loaded from a
+    .reg file keep a reference to their section of the file, which is only parsed when the values are accessed.
+    """
+    __slots__ = ["name", "parent", "children", "_values", "_value_order", "_child_order", "_pending"]
+
+    def __init__(self, name: str, parent: Optional["RegistryKey"] = None):
+        self.name = name
+        self.parent = parent
+        self.children: Dict[str, RegistryKey] = {}
+        self._values: Dict[str, RegistryValue] = {}
+        # Insertion order of the values (enumeration order of the real registry)
+        self._value_order: Optional[List[str]] = None
+        # Sorted children for enumeration by index, rebuilt after a child was added
+        self._child_order: Optional[List[RegistryKey]] = None
+        # (text, start, end) ranges of .reg files with the values of this key
+        self._pending: Optional[List[Tuple[str, int, int]]] = None
+
+    def __deepcopy__(self, memo):
+        # The registry is shared between snapshots (the guest cannot modify it)
+        return self
+
+    @property
+    def path(self) -> str:
+        names = []
+        key = self
+        while key.parent is not None:
+            names.append(key.name)
+            key = key.parent
+        return "\\" + "\\".join(reversed(names))
+
+    def child(self, name: str, create=False) -> Optional["RegistryKey"]:
+        folded = _fold(name)
+        key = self.children.get(folded, None)
+        if key is None and create:
+            key = RegistryKey(name, self)
+            self.children[folded] = key
+            self._child_order = None
+        return key
+
+    def subkey(self, index: int) -> Optional["RegistryKey"]:
+        if self._child_order is None:
+            self._child_order = [self.children[name] for name in sorted(self.children)]
+        if index < len(self._child_order):
+            return self._child_order[index]
+        return None
+
+    @property
+    def values(self) -> Dict[str, RegistryValue]:
+        if self._pending is not None:
+            pending, self._pending = self._pending, None
+            for text, start, end in pending:
+                _parse_reg_values(self, text, start, end)
+        return self._values
+
+    def value(self, name: str) -> Optional[RegistryValue]:
+        return self.values.get(_fold(name), None)
+
+    def value_at(self, index: int) -> Optional[RegistryValue]:
+        values = self.values
+        if self._value_order is None:
+            self._value_order = list(values)
+        if index < len(self._value_order):
+            return values[self._value_order[index]]
+        return None
+
+    def set_value(self, name: str, value: Any):
+        folded = _fold(name)
+        self.values[folded] = RegistryValue.from_python(name, value)
+        self._value_order = None
+
+    def delete_value(self, name: str):
+        if self.values.pop(_fold(name), None) is not None:
+            self._value_order = None
+
+    def __repr__(self):
+        return f"RegistryKey({self.path})"
+
+# Root keys of a .reg file and where they are in the object manager namespace
+REG_ROOTS = {
+    "hkey_local_machine": "\\Registry\\Machine",
+    "hklm": "\\Registry\\Machine",
+    "hkey_users": "\\Registry\\User",
+    "hku": "\\Registry\\User",
+    "hkey_classes_root": "\\Registry\\Machine\\Software\\Classes",
+    "hkcr": "\\Registry\\Machine\\Software\\Classes",
+    "hkey_current_config": "\\Registry\\Machine\\System\\CurrentControlSet\\Hardware Profiles\\Current",
+    "hkcc": "\\Registry\\Machine\\System\\CurrentControlSet\\Hardware Profiles\\Current",
+}
+
+_REG_HEADER = re.compile(r"^\[([^\r\n]*)\][ \t]*\r?$", re.MULTILINE)
+_REG_VALUE = re.compile(r'^(@|"(?:[^"\\]|\\.)*")=(.*)$', re.DOTALL)
+
+def _unescape(s: str) -> str:
+    return re.sub(r"\\(.)", r"\1", s)
+
+def _reg_data(data: str) -> Optional[Tuple[int, bytes]]:
+    # Returns (type, data) of a value in a .reg file, None to delete the value
+    if data == "-":
+        return None
+    if data.startswith('"'):
+        assert data.endswith('"'), f"Invalid string value {data}"
+        return REG_SZ, _unescape(data[1:-1]).encode("utf-16-le") + b"\0\0"
+    if data.startswith("dword:"):
+        return REG_DWORD, struct.pack("<I", int(data[6:], 16))
+    if data.startswith("hex"):
+        kind, _, content = data.partition(":")
+        value_type = REG_BINARY if kind == "hex" else int(kind[4:-1], 16)
+        content = content.replace("\\", "").replace(" ", "").replace("\t", "").replace("\r", "").replace("\n", "")
+        return value_type, bytes(int(b, 16) for b in content.split(",") if b)
+    if data.startswith("qword:"):
+        return REG_QWORD, struct.pack("<Q", int(data[6:], 16))
+    raise NotImplementedError(f"Unsupported .reg value {data[:32]}")
+
+def _parse_reg_values(key: RegistryKey, text: str, start: int, end: int):
+    # Lines ending with a backslash continue on the next line (hex data)
+    statement = ""
+    for line in text[start:end].splitlines():
+        if statement:
+            statement += line.strip()
+        else:
+            line = line.strip()
+            if not line or line.startswith(";"):
+                continue
+            statement = line
+        if statement.endswith("\\") and not statement.endswith('"'):
+            statement = statement[:-1]
+            continue
+        match = _REG_VALUE.match(statement)
+        statement = ""
+        if match is None:
+            continue
+        name, data = match.groups()
+        name = "" if name == "@" else _unescape(name[1:-1])
+        value = _reg_data(data.strip())
+        folded = _fold(name)
+        if value is None:
+            key._values.pop(folded, None)
+        else:
+            key._values[folded] = RegistryValue(name, value[0], value[1])
+    key._value_order = None
+
+class RegistryHive:
+    """
+    The registry as a trie of RegistryKey nodes, rooted at \\Registry. Exported .reg files are loaded lazily: the key
+    headers are indexed on the first registry access and the values of a key are parsed when it is first queried.
+    """
+    def __init__(self):
+        self.root = RegistryKey("")
+        self._sources: List[Tuple[str, str]] = []
+
+    def __deepcopy__(self, memo):
+        return self
+
+    @staticmethod
+    def _split(path: str) -> List[str]:
+        return [name for name in path.split("\\") if name]
+
+    def create(self, path: str, values: Optional[Dict[str, Any]] = None) -> RegistryKey:
+        key = self.root
+        for name in self._split(path):
+            key = key.child(name, create=True)
+        if values:
+            for name, value in values.items():
+                key.set_value(name, value)
+        return key
+
+    def find(self, path: str) -> Optional[RegistryKey]:
+        self._index()
+        key = self.root
+        for name in self._split(path):
+            key = key.child(name)
+            if key is None:
+                return None
+        return key
+
+    def load_reg(self, filename: str, current_user: str = ".DEFAULT"):
+        """
+        Load an exported .reg file. HKEY_CURRENT_USER is stored under \\Registry\\User\\<current_user>.
+        """
+        self._sources.append((filename, current_user))
+
+    def _index(self):
+        while self._sources:
+            filename, current_user = self._sources.pop(0)
+            with open(filename, "rb") as f:
+                data = f.read()
+            if data.startswith(b"\xff\xfe"):
+                text = data[2:].decode("utf-16-le")
+            elif data.startswith(b"\xef\xbb\xbf"):
+                text = data[3:].decode("utf-8")
+            else:
+                # REGEDIT4 files are in the ANSI code page
+                text = data.decode("latin-1")
+            del data
+            self._index_text(text, current_user)
+
+    def _index_text(self, text: str, current_user: str):
+        roots = dict(REG_ROOTS)
+        roots["hkey_current_user"] = roots["hkcu"] = "\\Registry\\User\\" + current_user
+        headers = list(_REG_HEADER.finditer(text))
+        # The keys are exported depth first, so the parent of a key was usually just created
+        parents: Dict[str, RegistryKey] = {}
+        for i, header in enumerate(headers):
+            path = header.group(1)
+            if path.startswith("-"):
+                # Deleting keys is not supported
+                continue
+            parent_path, _, name = path.rpartition("\\")
+            parent = parents.get(parent_path.lower(), None)
+            if parent is None:
+                root_name, _, rest = parent_path.partition("\\")
+                root = roots.get(root_name.lower(), None)
+                if root is None:
+                    if not parent_path:
+                        root = roots.get(name.lower(), None)
+                    if root is None:
+                        continue
+                    # The header is a root key
+                    parent_path, name, rest = "", "", root
+                else:
+                    rest = root + "\\" + rest
+                parent = self.root
+                for component in self._split(rest):
+                    parent = parent.child(component, create=True)
+                if parent_path:
+                    parents[parent_path.lower()] = parent
+            key = parent.child(name, create=True) if name else parent
+            parents[path.lower()] = key
+            end = headers[i + 1].start() if i + 1 < len(headers) else len(text)
+            if key._pending is None:
+                key._pending = []
+            key._pending.append((text, header.end(), end))
+
+    def walk(self, key: Optional[RegistryKey] = None) -> Iterator[RegistryKey]:
+        self._index()
+        stack = [key or self.root]
+        while stack:
+            key = stack.pop()
+            yield key
+            stack.extend(key.children.values())
@@ -0,0 +1,313 @@
+import struct
+from dataclasses import dataclass, field
+from enum import Enum
+from typing import Any, Dict, List, Optional, TYPE_CHECKING
+
+from unicorn.x86_const import *
+
+from .handles import EventObject, ThreadObject
+from .memory import MemoryProtect, MemoryType, PAGE_SIZE
+from .native import *
+
+if TYPE_CHECKING:
+    from .dumpulator import Dumpulator
+
+class ThreadState(Enum):
+    Ready = 0
+    Waiting = 1
+    Suspended = 2
+    Terminated = 3
+
+@dataclass
+class GuestThread:
+    obj: ThreadObject
+    teb: int
+    state: ThreadState = ThreadState.Ready
+    # Saved unicorn context (None for the running thread), treated as immutable so snapshots can share it
+    context: Any = None
+    # Return value of the wait syscall, written to cax when the thread resumes
+    wake_status: Optional[int] = None
+    # Objects the thread is waiting for
+    wait_objects: List[Any] = field(default_factory=list)
+    wait_all: bool = False
+    # The wait can be satisfied with STATUS_TIMEOUT when nothing else can run
+    wait_timeout: bool = False
+
+    @property
+    def thread_id(self):
+        return self.obj.thread_id
+
+class Scheduler:
+    """
+    Cooperative scheduler for the threads created by the guest. The running thread keeps going until it waits
+    for an object that is not signalled, yields, exits or runs out of its time slice (counted in instructions).
+    There is no clock: a wait with a timeout only times out when no other thread is able to run.
+    """
+    # Instructions executed before switching to the next ready thread
+    time_slice = 100000
+    stack_size = 0x100000
+
+    def __init__(self, dp: "Dumpulator", thread_id: int, teb: int):
+        self._dp = dp
+        self.current = GuestThread(ThreadObject(0, 0, thread_id), teb)
+        self.threads: Dict[int, GuestThread] = {thread_id: self.current}
+        self._next_thread_id = thread_id
+
+    @property
+    def multithreaded(self):
+        return any(thread.state == ThreadState.Ready for thread in self.threads.values() if thread is not self.current)
+
+    def find(self, obj: ThreadObject) -> Optional[GuestThread]:
+        return self.threads.get(obj.thread_id, None)
+
+    def _allocate_teb(self, thread_id: int, stack_base: int, stack_limit: int) -> int:
+        dp = self._dp
+        # WoW64 processes have the 64-bit TEB two pages before the 32-bit one
+        teb_size = 2 * PAGE_SIZE
+        source = dp.teb - teb_size if dp.wow64 else dp.teb
+        size = 2 * teb_size if dp.wow64 else teb_size
+        base = dp.memory.find_free(size)
+        assert base is not None, "Failed to find free memory for the TEB"
+        dp.memory.reserve(base, size, MemoryProtect.PAGE_READWRITE, MemoryType.MEM_PRIVATE, f"TEB (thread {thread_id})")
+        dp.memory.commit(base, size, MemoryProtect.PAGE_READWRITE)
+        dp.write(base, dp.read(source, size))
+        teb = base + teb_size if dp.wow64 else base
+        if dp.x64:
+            # https://www.vergiliusproject.com/kernels/x64/Windows%2011/21H2%20(RTM)/_TEB
+            dp.write_ptr(teb + 0x0, 0)  # ExceptionList
+            dp.write_ptr(teb + 0x8, stack_base)
+            dp.write_ptr(teb + 0x10, stack_limit)
+            dp.write_ptr(teb + 0x30, teb)  # Self
+            dp.write_ptr(teb + 0x48, thread_id)  # ClientId.UniqueThread
+            dp.write_ulong(teb + 0x68, 0)  # LastErrorValue
+            dp.write_ptr(teb + 0x1478, stack_limit)  # DeallocationStack
+        else:
+            # https://www.vergiliusproject.com/kernels/x86/Windows%2010/2110%2021H2%20(November%202021%20Update)/_TEB
+            dp.write_ptr(teb + 0x0, 0xFFFFFFFF)  # ExceptionList
+            dp.write_ptr(teb + 0x4, stack_base)
+            dp.write_ptr(teb + 0x8, stack_limit)
+            dp.write_ptr(teb + 0x18, teb)  # Self
+            dp.write_ptr(teb + 0x24, thread_id)  # ClientId.UniqueThread
+            dp.write_ulong(teb + 0x34, 0)  # LastErrorValue
+            dp.write_ptr(teb + 0xe0c, stack_limit)  # DeallocationStack
+            if dp.wow64:
+                teb64 = teb - teb_size
+                dp.write(teb64 + 0x30, struct.pack("<Q", teb64))  # Self
+                dp.write(teb64 + 0x48, struct.pack("<Q", thread_id))  # ClientId.UniqueThread
+        return teb
+
+    def create_thread(self, entry: int, argument: int, suspended=False) -> ThreadObject:
+        """
+        Create a thread that starts executing entry(argument) and exits when it returns.
+        Must be called while the emulator is stopped in a hook, the context of the new thread is derived from the
+        current one.
+        """
+        dp = self._dp
+        self._next_thread_id += 4
+        thread_id = self._next_thread_id
+        stack_limit = dp.memory.find_free(self.stack_size)
+        assert stack_limit is not None, "Failed to find free memory for the stack"
+        dp.memory.reserve(stack_limit, self.stack_size, MemoryProtect.PAGE_READWRITE, MemoryType.MEM_PRIVATE, f"Stack (thread {thread_id})")
+        dp.memory.commit(stack_limit, self.stack_size, MemoryProtect.PAGE_READWRITE)
+        stack_base = stack_limit + self.stack_size
+        teb = self._allocate_teb(thread_id, stack_base, stack_limit)
+
+        from .dumpulator import THREAD_EXIT_ADDR
+        context = dp._uc.context_save()
+        csp = (stack_base - 0x100) & ~0xF
+        if dp.x64:
+            # The return address is pushed by the (imaginary) call, the shadow space is above it
+            csp -= 8
+            dp.write_ptr(csp, THREAD_EXIT_ADDR)
+            context.reg_write(UC_X86_REG_RCX, argument)
+            context.reg_write(UC_X86_REG_GS_BASE, teb)
+        else:
+            csp -= 4
+            dp.write_ptr(csp, argument)
+            csp -= 4
+            dp.write_ptr(csp, THREAD_EXIT_ADDR)
+            context.reg_write(UC_X86_REG_FS_BASE, teb)
+            context.reg_write(UC_X86_REG_GS_BASE, teb - 2 * PAGE_SIZE)
+        context.reg_write(UC_X86_REG_RSP, csp)
+        context.reg_write(UC_X86_REG_RIP, entry)
+
+        obj = ThreadObject(entry, argument, thread_id)
+        state = ThreadState.Suspended if suspended else ThreadState.Ready
+        self.threads[thread_id] = GuestThread(obj, teb, state, context)
+        dp._setup_thread_exit()
+        return obj
+
+    @staticmethod
+    def _signalled(obj: Any) -> bool:
+        if isinstance(obj, EventObject):
+            return obj.signalled
+        if isinstance(obj, ThreadObject):
+            return obj.exit_status is not None
+        raise NotImplementedError(f"Waiting for {type(obj).__name__} is not supported")
+
+    @staticmethod
+    def _consume(obj: Any):
+        if isinstance(obj, EventObject) and obj.event_type == EVENT_TYPE.SynchronizationEvent:
+            obj.signalled = False
+
+    def _try_wait(self, objects: List[Any], wait_all: bool) -> Optional[int]:
+        # Returns the wait status when the wait is satisfied (and consumes the objects)
+        if wait_all:
+            if all(self._signalled(obj) for obj in objects):
+                for obj in objects:
+                    self._consume(obj)
+                return STATUS_SUCCESS
+            return None
+        for index, obj in enumerate(objects):
+            if self._signalled(obj):
+                self._consume(obj)
+                return STATUS_SUCCESS + index
+        return None
+
+    def signal(self):
+        """
+        Wake up the waiting threads whose objects became signalled. Called after an object changed state.
+        """
+        for thread in self.threads.values():
+            if thread.state != ThreadState.Waiting:
+                continue
+            status = self._try_wait(thread.wait_objects, thread.wait_all)
+            if status is not None:
+                self._wake(thread, status)
+
+    def _wake(self, thread: GuestThread, status: int):
+        thread.state = ThreadState.Ready
+        thread.wait_objects = []
+        thread.wake_status = status
+
+    def _next_ready(self) -> Optional[GuestThread]:
+        # Round-robin, starting after the current thread
+        threads = list(self.threads.values())
+        index = threads.index(self.current)
+        for thread in threads[index + 1:] + threads[:index]:
+            if thread.state == ThreadState.Ready:
+                return thread
+        return None
+
+    def _syscall_return(self, status: int):
+        # Context of the current thread as if the syscall returned with status
+        dp = self._dp
+        context = dp._uc.context_save()
+        cip = dp.regs.cip + 2
+        if dp.x64:
+            context.reg_write(UC_X86_REG_RCX, cip)
+            context.reg_write(UC_X86_REG_R11, dp.regs.eflags)
+        context.reg_write(UC_X86_REG_RIP, cip)
+        context.reg_write(UC_X86_REG_RAX, status)
+        return context
+
+    def _activate(self, thread: GuestThread):
+        # Load the context of thread into the emulator
+        dp = self._dp
+        dp.info(f"switching to thread {thread.thread_id}")
+        self.current = thread
+        dp.thread_id = thread.thread_id
+        dp.teb = thread.teb
+        dp._uc.context_restore(thread.context)
+        if thread.wake_status is not None:
+            dp.regs.cax = thread.wake_status
+            thread.wake_status = None
+        thread.context = None
+
+    def _switch(self, thread: GuestThread):
+        # Returns the pending exception that makes the emulation continue in thread
+        from .dumpulator import UnicornExceptionInfo, ExceptionType
+        dp = self._dp
+        self._activate(thread)
+        exception = UnicornExceptionInfo()
+        exception.type = ExceptionType.ContextSwitch
+        exception.final = True
+        exception.context = dp._uc.context_save()
+        return exception
+
+    def _pick_after_block(self) -> Any:
+        thread = self._next_ready()
+        if thread is None:
+            # Nothing can run, time out one of the waits
+            for candidate in self.threads.values():
+                if candidate.state == ThreadState.Waiting and candidate.wait_timeout:
+                    self._wake(candidate, STATUS_TIMEOUT)
+                    thread = candidate
+                    break
+        if thread is None:
+            raise Exception("Deadlock: all threads are waiting")
+        return self._switch(thread)
+
+    def wait(self, objects: List[Any], wait_all: bool, timeout: Optional[int]):
+        """
+        Implementation of the wait syscalls, timeout is None for an infinite wait. Returns the status of the
+        syscall, or an exception that switches to another thread.
+        """
+        status = self._try_wait(objects, wait_all)
+        if status is not None:
+            return status
+        if timeout == 0:
+            return STATUS_TIMEOUT
+        current = self.current
+        current.state = ThreadState.Waiting
+        current.wait_objects = list(objects)
+        current.wait_all = wait_all
+        current.wait_timeout = timeout is not None
+        current.context = self._syscall_return(STATUS_TIMEOUT)
+        return self._pick_after_block()
+
+    def yield_execution(self, status: int):
+        """
+        Let the other ready threads run (NtYieldExecution, NtDelayExecution).
+        """
+        thread = self._next_ready()
+        if thread is None:
+            return status
+        self.current.context = self._syscall_return(status)
+        return self._switch(thread)
+
+    def resume(self, obj: ThreadObject) -> bool:
+        thread = self.find(obj)
+        if thread is None or thread.state != ThreadState.Suspended:
+            return False
+        thread.state = ThreadState.Ready
+        return True
+
+    def terminate(self, obj: ThreadObject, exit_status: int):
+        """
+        Terminate a thread. Returns None when the emulation can continue in the current thread, an exception that
+        switches to another thread, or the exception that terminates the emulation when no threads are left.
+        """
+        thread = self.find(obj)
+        if thread is None or thread.state == ThreadState.Terminated:
+            return None
+        obj.exit_status = exit_status
+        thread.state = ThreadState.Terminated
+        thread.context = None
+        self.signal()
+        if thread is not self.current:
+            return None
+        next_thread = self._next_ready()
+        if next_thread is None and any(t.state == ThreadState.Waiting for t in self.threads.values()):
+            return self._pick_after_block()
+        if next_thread is None:
+            from .dumpulator import UnicornExceptionInfo, ExceptionType
+            dp = self._dp
+            dp.stop(exit_status)
+            exception = UnicornExceptionInfo()
+            exception.type = ExceptionType.Terminate
+            exception.final = True
+            exception.context = dp._uc.context_save()
+            return exception
+        return self._switch(next_thread)
+
+    def preempt(self) -> bool:
+        """
+        Called when the time slice of the current thread ran out, switches to the next ready thread.
+        """
+        thread = self._next_ready()
+        if thread is None:
+            return False
+        self.current.context = self._dp._uc.context_save()
+        self._activate(thread)
+        return True
@@ -0,0 +1,394 @@
+import atexit
+import struct
+from dataclasses import dataclass
+from typing import BinaryIO, Dict, Iterator, List, NamedTuple, Optional, TextIO, Tuple
+
+from unicorn.x86_const import *
+
+# Binary trace format (all values little endian):
+#   header: TRACE_MAGIC, u16 version, u8 x64, u16 names length, comma separated register names
+#   records: u8 record type, followed by the record specific data
+#   instruction: _INSTRUCTION_HEADER, the instruction bytes (code size), a u64 for every bit set in the register mask
+#   module: _MODULE_HEADER, the name (utf-8)
+#   symbol: _SYMBOL_HEADER, the name (utf-8)
+# Instruction records store the registers that changed since the previous instruction record, so the records are
+# variable-length and the trace has to be read from the start. Fixed-size records would need room for every register
+# and the instruction bytes (over 200 bytes per x64 instruction, a typical delta record is around 50 bytes), and a
+# compressed trace cannot be seeked into either way.
+TRACE_MAGIC = b"DPTRACE\0"
+TRACE_VERSION = 1
+ZSTD_MAGIC = b"\x28\xb5\x2f\xfd"
+
+RECORD_INSTRUCTION = 0
+RECORD_MODULE = 1
+RECORD_SYMBOL = 2
+
+# address, module id, code size, sequence id, register mask
+_INSTRUCTION_HEADER = struct.Struct("<QHBII")
+# module id, base, size, name length
+_MODULE_HEADER = struct.Struct("<HQIH")
+# address, name length
+_SYMBOL_HEADER = struct.Struct("<QH")
+_HEADER = struct.Struct("<HBH")
+
+NO_MODULE = 0xFFFF
+
+TRACE_REGISTERS_X64 = [
+    ("rax", UC_X86_REG_RAX),
+    ("rcx", UC_X86_REG_RCX),
+    ("rdx", UC_X86_REG_RDX),
+    ("rbx", UC_X86_REG_RBX),
+    ("rsp", UC_X86_REG_RSP),
+    ("rbp", UC_X86_REG_RBP),
+    ("rsi", UC_X86_REG_RSI),
+    ("rdi", UC_X86_REG_RDI),
+    ("r8", UC_X86_REG_R8),
+    ("r9", UC_X86_REG_R9),
+    ("r10", UC_X86_REG_R10),
+    ("r11", UC_X86_REG_R11),
+    ("r12", UC_X86_REG_R12),
+    ("r13", UC_X86_REG_R13),
+    ("r14", UC_X86_REG_R14),
+    ("r15", UC_X86_REG_R15),
+    ("rip", UC_X86_REG_RIP),
+    ("rflags", UC_X86_REG_RFLAGS),
+    ("cs", UC_X86_REG_CS),
+    ("ss", UC_X86_REG_SS),
+    ("ds", UC_X86_REG_DS),
+    ("es", UC_X86_REG_ES),
+    ("fs", UC_X86_REG_FS),
+    ("gs", UC_X86_REG_GS),
+]
+
+TRACE_REGISTERS_X86 = [
+    ("eax", UC_X86_REG_EAX),
+    ("ecx", UC_X86_REG_ECX),
+    ("edx", UC_X86_REG_EDX),
+    ("ebx", UC_X86_REG_EBX),
+    ("esp", UC_X86_REG_ESP),
+    ("ebp", UC_X86_REG_EBP),
+    ("esi", UC_X86_REG_ESI),
+    ("edi", UC_X86_REG_EDI),
+    ("eip", UC_X86_REG_EIP),
+    ("eflags", UC_X86_REG_EFLAGS),
+    ("cs", UC_X86_REG_CS),
+    ("ss", UC_X86_REG_SS),
+    ("ds", UC_X86_REG_DS),
+    ("es", UC_X86_REG_ES),
+    ("fs", UC_X86_REG_FS),
+    ("gs", UC_X86_REG_GS),
+]
+
+class BinaryTraceWriter:
+    def __init__(self, filename: str, x64: bool, *, compress=False, batch_size=1024 * 1024):
+        self.filename = filename
+        self.registers = TRACE_REGISTERS_X64 if x64 else TRACE_REGISTERS_X86
+        self.register_ids = [reg for _, reg in self.registers]
+        self._raw = open(filename, "wb")
+        self._file: BinaryIO = self._raw
+        if compress:
+            try:
+                import zstandard
+            except ImportError:
+                self._raw.close()
+                raise ImportError("the zstandard package is required for compressed traces (pip install zstandard)") from None
+            self._file = zstandard.ZstdCompressor().stream_writer(self._raw)
+        self._batch_size = batch_size
+        self._buffer = bytearray()
+        self._previous: List[Optional[int]] = [None] * len(self.registers)
+        self._modules: Dict[int, int] = {}
+        self._symbols = set()
+        self.closed = False
+
+        names = ",".join(name for name, _ in self.registers).encode()
+        self._buffer += TRACE_MAGIC
+        self._buffer += _HEADER.pack(TRACE_VERSION, 1 if x64 else 0, len(names))
+        self._buffer += names
+        # Make sure the buffered records end up on disk
+        atexit.register(self.close)
+
+    def module_id(self, module) -> int:
+        if module is None:
+            return NO_MODULE
+        module_id = self._modules.get(module.base, None)
+        if module_id is None:
+            module_id = len(self._modules)
+            self._modules[module.base] = module_id
+            name = module.name.encode("utf-8")
+            self._buffer.append(RECORD_MODULE)
+            self._buffer += _MODULE_HEADER.pack(module_id, module.base, module.size, len(name))
+            self._buffer += name
+        return module_id
+
+    def symbol(self, address: int, name: str):
+        if address in self._symbols:
+            return
+        self._symbols.add(address)
+        data = name.encode("utf-8")
+        self._buffer.append(RECORD_SYMBOL)
+        self._buffer += _SYMBOL_HEADER.pack(address, len(data))
+        self._buffer += data
+
+    def instruction(self, address: int, code: bytes, module_id: int, sequence_id: int, values: List[int]):
+        mask = 0
+        changed = []
+        previous = self._previous
+        for i, value in enumerate(values):
+            if previous[i] != value:
+                previous[i] = value
+                mask |= 1 << i
+                changed.append(value)
+        buffer = self._buffer
+        buffer.append(RECORD_INSTRUCTION)
+        buffer += _INSTRUCTION_HEADER.pack(address, module_id, len(code), sequence_id & 0xFFFFFFFF, mask)
+        buffer += code
+        buffer += struct.pack(f"<{len(changed)}Q", *changed)
+        if len(buffer) >= self._batch_size:
+            self._write_buffer()
+
+    def _write_buffer(self):
+        if self._buffer:
+            self._file.write(self._buffer)
+            self._buffer = bytearray()
+
+    def flush(self):
+        if self.closed:
+            return
+        self._write_buffer()
+        self._file.flush()
+
+    def close(self):
+        if self.closed:
+            return
+        self._write_buffer()
+        self._file.close()
+        if self._file is not self._raw and not self._raw.closed:
+            self._raw.close()
+        self.closed = True
+        atexit.unregister(self.close)
+
+@dataclass
+class TraceBlock:
+    address: int
+    size: int
+    icount: int
+    module: str
+    hits: int = 0
+
+class BlockTraceWriter:
+    """
+    Records the executed basic blocks and the edges between them. The totals are written to the output file
+    every time the trace is flushed.
+    """
+    def __init__(self, filename: str):
+        self.filename = filename
+        self.blocks: Dict[int, TraceBlock] = {}
+        self.edges: Dict[Tuple[int, int], int] = {}
+        self.previous: Optional[int] = None
+        self._dirty = False
+        self.closed = False
+        atexit.register(self.close)
+
+    def block(self, address: int, size: int, icount: int, module: str):
+        # Blocks can be retranslated with a different size (self-modifying code)
+        previous = self.blocks.get(address, None)
+        hits = 0 if previous is None else previous.hits
+        self.blocks[address] = TraceBlock(address, size, icount, module, hits)
+
+    def hit(self, address: int):
+        self.blocks[address].hits += 1
+        if self.previous is not None:
+            edge = (self.previous, address)
+            self.edges[edge] = self.edges.get(edge, 0) + 1
+        self.previous = address
+        self._dirty = True
+
+    def flush(self):
+        if self.closed or not self._dirty:
+            return
+        self._dirty = False
+        with open(self.filename, "w") as f:
+            f.write("# block <address> <size> <icount> <hits> <module>\n")
+            for block in sorted(self.blocks.values(), key=lambda b: b.address):
+                f.write(f"block {hex(block.address)} {hex(block.size)} {block.icount} {block.hits} {block.module}\n")
+            f.write("# edge <from> <to> <count>\n")
+            for (source, target), count in sorted(self.edges.items()):
+                f.write(f"edge {hex(source)} {hex(target)} {count}\n")
+
+    def close(self):
+        if self.closed:
+            return
+        self.flush()
+        self.closed = True
+        atexit.unregister(self.close)
+
+class TraceModule(NamedTuple):
+    id: int
+    base: int
+    size: int
+    name: str
+
+class TraceInstruction(NamedTuple):
+    address: int
+    module: Optional[TraceModule]
+    symbol: Optional[str]
+    code: bytes
+    sequence_id: int
+    # Values of all the traced registers before the instruction executed
+    registers: Dict[str, int]
+
+def _open_trace(filename: str) -> BinaryIO:
+    f = open(filename, "rb")
+    magic = f.read(4)
+    f.seek(0)
+    if magic == ZSTD_MAGIC:
+        import zstandard
+        return zstandard.ZstdDecompressor().stream_reader(f, closefd=True)
+    return f
+
+def _read_exact(f: BinaryIO, size: int) -> bytes:
+    data = f.read(size)
+    while len(data) < size:
+        chunk = f.read(size - len(data))
+        if not chunk:
+            raise EOFError("Truncated trace")
+        data += chunk
+    return data
+
+def read_trace(filename: str) -> Iterator[TraceInstruction]:
+    """
+    Iterate over the instructions in a binary trace written with trace="binary" or trace="zstd".
+    """
+    with _open_trace(filename) as f:
+        if _read_exact(f, len(TRACE_MAGIC)) != TRACE_MAGIC:
+            raise ValueError(f"{filename} is not a dumpulator binary trace")
+        version, x64, names_length = _HEADER.unpack(_read_exact(f, _HEADER.size))
+        if version != TRACE_VERSION:
+            raise ValueError(f"Unsupported trace version {version}")
+        names = _read_exact(f, names_length).decode().split(",")
+        values = [0] * len(names)
+        modules: Dict[int, TraceModule] = {}
+        symbols: Dict[int, str] = {}
+        while True:
+            record_type = f.read(1)
+            if not record_type:
+                break
+            record_type = record_type[0]
+            if record_type == RECORD_INSTRUCTION:
+                address, module_id, code_size, sequence_id, mask = _INSTRUCTION_HEADER.unpack(_read_exact(f, _INSTRUCTION_HEADER.size))
+                code = _read_exact(f, code_size)
+                count = bin(mask).count("1")
+                changed = struct.unpack(f"<{count}Q", _read_exact(f, count * 8))
+                index = 0
+                for i in range(len(names)):
+                    if mask & (1 << i):
+                        values[i] = changed[index]
+                        index += 1
+                yield TraceInstruction(address, modules.get(module_id, None), symbols.get(address, None), code, sequence_id, dict(zip(names, values)))
+            elif record_type == RECORD_MODULE:
+                module_id, base, size, name_length = _MODULE_HEADER.unpack(_read_exact(f, _MODULE_HEADER.size))
+                name = _read_exact(f, name_length).decode("utf-8")
+                modules[module_id] = TraceModule(module_id, base, size, name)
+            elif record_type == RECORD_SYMBOL:
+                address, name_length = _SYMBOL_HEADER.unpack(_read_exact(f, _SYMBOL_HEADER.size))
+                symbols[address] = _read_exact(f, name_length).decode("utf-8")
+            else:
+                raise ValueError(f"Unknown trace record type {record_type}")
+
+def _register_lookup(registers: Dict[str, int], name: str) -> Optional[int]:
+    # Resolve sub-registers (eax, ax, al, ah, r8d, ...) from the traced full registers
+    value = registers.get(name, None)
+    if value is not None:
+        return value
+    if name == "eflags":
+        return registers.get("rflags", None)
+    legacy = {"ax", "bx", "cx", "dx", "sp", "bp", "si", "di", "ip"}
+    def full(base: str):
+        return registers.get("r" + base, registers.get("e" + base, None))
+    if len(name) == 3 and name[0] == "e" and name[1:] in legacy:
+        value = full(name[1:])
+        return None if value is None else value & 0xFFFFFFFF
+    if name in legacy:
+        value = full(name)
+        return None if value is None else value & 0xFFFF
+    if len(name) == 2 and name[1] in "lh" and name[0] in "abcd":
+        value = full(name[0] + "x")
+        if value is None:
+            return None
+        return value & 0xFF if name[1] == "l" else (value >> 8) & 0xFF
+    if name in ["sil", "dil", "bpl", "spl"]:
+        value = full(name[:2])
+        return None if value is None else value & 0xFF
+    if name.startswith("r") and name[-1] in "dwb" and name[1:-1].isdigit():
+        value = registers.get(name[:-1], None)
+        if value is None:
+            return None
+        return value & {"d": 0xFFFFFFFF, "w": 0xFFFF, "b": 0xFF}[name[-1]]
+    return None
+
+def convert_trace(filename: str, output: TextIO, *, x64dbg_format=False):
+    """
+    Convert a binary trace to the text format written with trace=True. When x64dbg_format is set the output
+    matches the format of tests/x64dbg-tracedump.py instead (no symbols or annotations), which makes it easy
+    to diff against a trace recorded with x64dbg.
+    """
+    from capstone import Cs, CS_ARCH_X86, CS_MODE_32, CS_MODE_64
+    from .dumpulator import _get_regs
+
+    disassemblers = {}
+    def disassembler(x64: bool):
+        cs = disassemblers.get(x64, None)
+        if cs is None:
+            cs = Cs(CS_ARCH_X86, CS_MODE_64 if x64 else CS_MODE_32)
+            cs.detail = True
+            disassemblers[x64] = cs
+        return cs
+
+    previous_module = None
+    for entry in read_trace(filename):
+        x64 = "rip" in entry.registers
+        address_name = ""
+        if not x64dbg_format:
+            if entry.module is not None and entry.module is not previous_module:
+                address_name = " " + entry.module.name
+            if entry.symbol:
+                address_name = " " + entry.symbol
+        previous_module = entry.module
+
+        line = f"{hex(entry.address)}{address_name}|"
+        instr = next(disassembler(x64).disasm(entry.code, entry.address, 1), None)
+        if instr is not None:
+            line += instr.mnemonic
+            if instr.op_str:
+                line += " "
+                line += instr.op_str
+            for reg in _get_regs(instr):
+                value = _register_lookup(entry.registers, reg)
+                if value is not None:
+                    line += f"|{reg}={hex(value)}"
+                else:
+                    line += f"|{reg}=0x???"
+            if not x64dbg_format:
+                if instr.mnemonic == "call":
+                    # print return address
+                    line += f"|return_address={hex(entry.address + instr.size)}"
+                elif instr.mnemonic in {"syscall", "sysenter"}:
+                    line += f"|sequence_id=[{entry.sequence_id}]"
+        else:
+            line += f"??? (code: {entry.code.hex()}, size: {hex(len(entry.code))})"
+        line += "\n"
+        output.write(line)
+
+def main():
+    import argparse
+    parser = argparse.ArgumentParser(description="Convert a dumpulator binary trace to text")
+    parser.add_argument("trace", help="binary trace file (.trace.bin or .trace.zst)")
+    parser.add_argument("-o", "--output", help="output file (default: <trace>.txt)")
+    parser.add_argument("--x64dbg", action="store_true", help="use the format of x64dbg-tracedump.py")
+    args = parser.parse_args()
+    output = args.output or args.trace + ".txt"
+    with open(output, "w") as f:
+        convert_trace(args.trace, f, x64dbg_format=args.x64dbg)
+
+if __name__ == "__main__":
+    main()
@@ -1,4 +1,32 @@
 
+def stream_search(file_handle, file_address, size, pattern, chunksize = 50*1024, start = 0):
+	"""
+	Yields the offsets (relative to file_address) of every occurrence of pattern in the size bytes at file_address.
+	The data is read chunksize bytes at a time, keeping len(pattern)-1 bytes of overlap so matches spanning two reads are found.
+	Overlapping occurrences are reported, the file position is left wherever the search stopped.
+	"""
+	if len(pattern) == 0 or start + len(pattern) > size:
+		return
+	overlap = len(pattern) - 1
+	chunksize = max(chunksize, len(pattern))
+	file_handle.seek(file_address + start, 0)
+	data = b''
+	base = start
+	read = start
+	while read < size:
+		chunk = file_handle.read(min(chunksize, size - read))
+		if not chunk:
+			return
+		read += len(chunk)
+		data = data + chunk if data else chunk
+		marker = data.find(pattern)
+		while marker != -1:
+			yield base + marker
+			marker = data.find(pattern, marker + 1)
+		if len(data) > overlap:
+			base += len(data) - overlap
+			data = data[len(data) - overlap:] if overlap > 0 else b''
+
 # https://msdn.microsoft.com/en-us/library/windows/desktop/ms680383(v=vs.85).aspx	
 class MINIDUMP_LOCATION_DESCRIPTOR:
 	def __init__(self):
@@ -159,82 +187,41 @@ class MinidumpMemorySegment:
 		if len(pattern) > self.size:
 			return []
 		pos = file_handler.tell()
-		file_handler.seek(self.start_file_address, 0)
 		fl = []
-		if find_first is True:
-			chunksize = min(chunksize, self.size)
-			data = b''
-			i = 0
-			while len(data) < self.size:
-				i += 1
-				if chunksize > (self.size - len(data)):
-					chunksize = (self.size - len(data))
-				data += file_handler.read(chunksize)
-				marker = data.find(pattern)
-				if marker != -1:
-					#print('FOUND! size: %s i: %s read: %s perc: %s' % (self.size, i, i*chunksize, 100*((i*chunksize)/self.size)))
-					file_handler.seek(pos, 0)
-					return [self.start_virtual_address + marker]
-			
-			
-			#print('NOTFOUND! size: %s i: %s read: %s perc %s' % (self.size, i, len(data), 100*(len(data)/self.size) ))
-			
-		else:
-			data = file_handler.read(self.size)
-			file_handler.seek(pos, 0)
-			
-			offset = 0
-			while len(data) > len(pattern):
-				marker = data.find(pattern)
-				if marker == -1:
-					return fl
-				fl.append(marker + offset + self.start_virtual_address)
-				data = data[marker+1:]
-				offset += marker + 1
-				if find_first is True:
-					return fl
-		
+		for offset in stream_search(file_handler, self.start_file_address, self.size, pattern, chunksize):
+			fl.append(self.start_virtual_address + offset)
+			if find_first is True:
+				break
 		file_handler.seek(pos, 0)
 		return fl
 
 	async def asearch(self, pattern, file_handler, find_first = False, chunksize = 50*1024):
-		if len(pattern) > self.size:
+		if len(pattern) > self.size or len(pattern) == 0:
 			return []
 		pos = file_handler.tell()
 		await file_handler.seek(self.start_file_address, 0)
 		fl = []
-		
-		if find_first is True:
-			chunksize = min(chunksize, self.size)
-			data = b''
-			i = 0
-			while len(data) < self.size:
-				i += 1
-				if chunksize > (self.size - len(data)):
-					chunksize = (self.size - len(data))
-				data += await file_handler.read(chunksize)
-				marker = data.find(pattern)
-				if marker != -1:
-					#print('FOUND! size: %s i: %s read: %s perc: %s' % (self.size, i, i*chunksize, 100*((i*chunksize)/self.size)))
-					await file_handler.seek(pos, 0)
-					return [self.start_virtual_address + marker]
-			
-			
-			#print('NOTFOUND! size: %s i: %s read: %s perc %s' % (self.size, i, len(data), 100*(len(data)/self.size) ))
-		
-		else:
-			offset = 0
-			data = await file_handler.read(self.size)
-			await file_handler.seek(pos, 0)
-			while len(data) > len(pattern):
-				marker = data.find(pattern)
-				if marker == -1:
-					return fl
-				fl.append(marker + offset + self.start_virtual_address)
-				data = data[marker+1:]
-				offset += marker + 1
+		overlap = len(pattern) - 1
+		chunksize = max(chunksize, len(pattern))
+		data = b''
+		base = 0
+		read = 0
+		while read < self.size:
+			chunk = await file_handler.read(min(chunksize, self.size - read))
+			if not chunk:
+				break
+			read += len(chunk)
+			data = data + chunk if data else chunk
+			marker = data.find(pattern)
+			while marker != -1:
+				fl.append(self.start_virtual_address + base + marker)
 				if find_first is True:
+					await file_handler.seek(pos, 0)
 					return fl
+				marker = data.find(pattern, marker + 1)
+			if len(data) > overlap:
+				base += len(data) - overlap
+				data = data[len(data) - overlap:] if overlap > 0 else b''
 		
 		await file_handler.seek(pos, 0)
 		return fl
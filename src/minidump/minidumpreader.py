@@ -5,30 +5,47 @@
 #
 import struct
 import ntpath
+import bisect
+from collections import OrderedDict
 from .common_structs import *
+from . import patternsearch
 from .streams.SystemInfoStream import PROCESSOR_ARCHITECTURE
 
-class VirtualSegment:
-	def __init__(self, start, end, start_file_address):
-		self.start = start
-		self.end = end
-		self.start_file_address = start_file_address
-
-		
-
-		self.data = None
-	
-	def inrange(self, start, end):
-		return self.start <= start and end<= self.end
+class MinidumpChunkCache:
+	"""
+	Bounded LRU cache of fixed size chunks read from the minidump file, shared by all buffered segments.
+	Chunks are aligned to the start of their segment and keyed by their file offset, so no chunk straddles two segments.
+	"""
+	def __init__(self, chunksize = 10*1024, max_chunks = 1024):
+		self.chunksize = chunksize
+		self.max_chunks = max(max_chunks, 1)
+		self.chunks = OrderedDict()
+
+	def get(self, file_handle, file_address, size):
+		data = self.chunks.get(file_address)
+		if data is not None:
+			self.chunks.move_to_end(file_address)
+			return data
+		file_handle.seek(file_address)
+		data = file_handle.read(size)
+		self.chunks[file_address] = data
+		if len(self.chunks) > self.max_chunks:
+			self.chunks.popitem(last = False)
+		return data
+
+	def clear(self):
+		self.chunks.clear()
 
 class MinidumpBufferedMemorySegment:
-	def __init__(self, memory_segment, file_handle, chunksize = 10*1024):
+	def __init__(self, memory_segment, file_handle, chunksize = 10*1024, cache = None):
 		self.start_address = memory_segment.start_virtual_address
 		self.end_address = memory_segment.end_virtual_address
 		self.total_size = memory_segment.end_virtual_address - memory_segment.start_virtual_address
 		self.start_file_address = memory_segment.start_file_address
-		self.chunksize = chunksize
-		self.chunks = []
+		self.cache = cache if cache is not None else MinidumpChunkCache(chunksize)
+		self.chunksize = self.cache.chunksize
+		# reads at least this big go straight to the file instead of evicting the whole cache
+		self.bypass_size = 4 * self.chunksize
 
 	def inrange(self, position):
 		return self.start_address <= position < self.end_address
@@ -38,68 +55,80 @@ class MinidumpBufferedMemorySegment:
 			return None
 		return self.end_address - position
 
-	def find(self, file_handle, pattern, startpos):
-		data = self.read(file_handle, 0, -1)
-		return data.find(pattern, startpos)
+	def find(self, file_handle, pattern, startpos = 0):
+		"""
+		Returns the offset (relative to the segment start) of the first occurrence of pattern at or after startpos, or -1
+		"""
+		for offset in stream_search(file_handle, self.start_file_address, self.total_size, pattern, self.bypass_size, startpos):
+			return offset
+		return -1
+
+	def readinto(self, file_handle, start, buffer):
+		"""
+		Reads len(buffer) bytes at offset start of the segment directly into buffer, bypassing the cache
+		"""
+		view = memoryview(buffer).cast('B')
+		if start < 0 or start + len(view) > self.total_size:
+			raise Exception('Read would cross segment boundaries!')
+		file_handle.seek(self.start_file_address + start)
+		total = 0
+		while total < len(view):
+			n = file_handle.readinto(view[total:])
+			if not n:
+				break
+			total += n
+		return total
 
 	def read(self, file_handle, start, end):
 		if end is None:
+			end = self.total_size
+		size = end - start
+		if size >= self.bypass_size:
 			file_handle.seek(self.start_file_address + start)
-			return file_handle.read(self.end_address - (self.start_file_address + start))
-		
-		for chunk in self.chunks:
-			if chunk.inrange(start, end):
-				return chunk.data[start - chunk.start: end - chunk.start]
-		
-		if self.total_size <= 2*self.chunksize:
-			chunksize = self.total_size
-			vs = VirtualSegment(0, chunksize, self.start_file_address)
-			file_handle.seek(self.start_file_address)
-			vs.data = file_handle.read(chunksize)
-			self.chunks.append(vs)
-			return vs.data[start - vs.start: end - vs.start]
-
-		chunksize = max((end-start), self.chunksize)
-		if start + chunksize > self.end_address:
-			chunksize = self.end_address - start
-		
-		vs = VirtualSegment(start, start+chunksize, self.start_file_address + start)
-		file_handle.seek(vs.start_file_address)
-		vs.data = file_handle.read(chunksize)
-		self.chunks.append(vs)
-		
-		return vs.data[start - vs.start: end - vs.start]
+			return file_handle.read(size)
+
+		result = []
+		offset = start
+		while offset < end:
+			chunk_start = offset - offset % self.chunksize
+			chunk_size = min(self.chunksize, self.total_size - chunk_start)
+			data = self.cache.get(file_handle, self.start_file_address + chunk_start, chunk_size)
+			chunk_end = min(end, chunk_start + chunk_size)
+			result.append(data[offset - chunk_start:chunk_end - chunk_start])
+			offset = chunk_end
+		if len(result) == 1:
+			return result[0]
+		return b''.join(result)
 
 
 
 class MinidumpBufferedReader:
-	def __init__(self, reader, segment_chunk_size = 10*1024):
+	def __init__(self, reader, segment_chunk_size = 10*1024, cache_size = 16*1024*1024):
 		self.reader = reader
 		self.segment_chunk_size = segment_chunk_size
-		self.memory_segments = []
+		self.cache = MinidumpChunkCache(segment_chunk_size, cache_size // segment_chunk_size)
+		self.memory_segments = {}
 
 		self.current_segment = None
 		self.current_position = None
 
+		# the segments sorted by start address, used to look up an address with bisect
+		self._segments = sorted(reader.memory_segments, key = lambda ms: ms.start_virtual_address)
+		self._segment_starts = [ms.start_virtual_address for ms in self._segments]
+
 	def _select_segment(self, requested_position):
 		"""
-
+		Makes the segment containing requested_position the current one
 		"""
-		# check if we have semgnet for requested address in cache
-		for memory_segment in self.memory_segments:
-			if memory_segment.inrange(requested_position):
-				self.current_segment = memory_segment
-				self.current_position = requested_position
-				return
-
-		# not in cache, check if it's present in memory space. if yes then create a new buffered memeory object, and copy data
-		for memory_segment in self.reader.memory_segments:
-			if memory_segment.inrange(requested_position):
-				newsegment = MinidumpBufferedMemorySegment(memory_segment, self.reader.file_handle, chunksize=self.segment_chunk_size)
-				self.memory_segments.append(newsegment)
-				self.current_segment = newsegment
-				self.current_position = requested_position
-				return
+		index = bisect.bisect_right(self._segment_starts, requested_position) - 1
+		if index >= 0 and self._segments[index].inrange(requested_position):
+			newsegment = self.memory_segments.get(index)
+			if newsegment is None:
+				newsegment = MinidumpBufferedMemorySegment(self._segments[index], self.reader.file_handle, cache = self.cache)
+				self.memory_segments[index] = newsegment
+			self.current_segment = newsegment
+			self.current_position = requested_position
+			return
 
 		raise Exception('Memory address 0x%08x is not in process memory space' % requested_position)
 
@@ -212,14 +241,23 @@ class MinidumpBufferedReader:
 		else:
 			return int.from_bytes(self.read(4), byteorder = 'little', signed = False)
 
+	def readinto(self, buffer):
+		"""
+		Reads len(buffer) bytes from the current position into buffer without going through the chunk cache.
+		Meant for large sequential reads, returns the number of bytes read
+		"""
+		n = self.current_segment.readinto(self.reader.file_handle, self.current_position - self.current_segment.start_address, buffer)
+		self.current_position += n
+		return n
+
 	def find(self, pattern):
 		"""
-		Searches for a pattern in the current memory segment
+		Searches for a pattern in the current memory segment, starting at the current position
 		"""
-		pos = self.current_segment.find(self.reader.file_handle, pattern)
+		pos = self.current_segment.find(self.reader.file_handle, pattern, self.current_position - self.current_segment.start_address)
 		if pos == -1:
 			return -1
-		return pos + self.current_position
+		return pos + self.current_segment.start_address
 
 	def find_all(self, pattern):
 		"""
@@ -314,8 +352,8 @@ class MinidumpFileReader:
 	def get_memory(self):
 		return self.memory_segments
 
-	def get_buffered_reader(self, segment_chunk_size = 10*1024):
-		return MinidumpBufferedReader(self, segment_chunk_size = segment_chunk_size)
+	def get_buffered_reader(self, segment_chunk_size = 10*1024, cache_size = 16*1024*1024):
+		return MinidumpBufferedReader(self, segment_chunk_size = segment_chunk_size, cache_size = cache_size)
 
 	def get_module_by_name(self, module_name):
 		for mod in self.modules:
@@ -353,6 +391,22 @@ class MinidumpFileReader:
 
 		return t
 
+	def search_many(self, patterns, module_name = None, workers = None):
+		"""
+		Searches for all patterns in a single pass over the memory (of a module) and returns a list of (pattern_id, virtual_address) sorted by address.
+		The pattern_id is the index in patterns, large dumps on disk are scanned in parallel where worker processes can be forked (see patternsearch.search_many).
+		"""
+		segments = self.memory_segments
+		if module_name is not None:
+			mod = self.get_module_by_name(module_name)
+			if mod is None:
+				mod = self.get_unloaded_by_name(module_name)
+				if mod is None:
+					raise Exception('Could not find module! %s' % module_name)
+			segments = [ms for ms in segments if mod.baseaddress <= ms.start_virtual_address < mod.endaddress]
+		ranges = [(ms.start_file_address, ms.size, ms.start_virtual_address) for ms in segments]
+		return patternsearch.search_many(self.filename, self.file_handle, ranges, patterns, workers = workers)
+
 	def read(self, virt_addr, size):
 		for segment in self.memory_segments:
 			if segment.inrange(virt_addr):
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# Multi-pattern search over the memory segments of a minidump
+#
+import os
+import mmap
+
+from minidump.utils.workers import process_pool
+
+# Minimum number of bytes to scan in worker processes (see process_pool)
+PARALLEL_THRESHOLD = 64*1024*1024
+# Large segments are split in pieces of this size so they can be spread over the workers
+PIECE_SIZE = 32*1024*1024
+
+class PatternMatcher:
+	"""
+	Matches a set of byte patterns against the same data. Duplicate patterns are only searched once.
+	Every pattern is located with bytes.find, which runs in C. On CPython this was several times faster than a regex
+	alternation of the patterns (and an automaton stepping byte by byte in Python would be slower still), so the
+	speedup comes from reading the dump once and from spreading the pieces over multiple processes.
+	"""
+	def __init__(self, patterns):
+		self.patterns = [bytes(p) for p in patterns]
+		if len(self.patterns) == 0:
+			raise ValueError('No patterns to search for')
+		self.unique = {}
+		for pattern_id, pattern in enumerate(self.patterns):
+			if len(pattern) == 0:
+				raise ValueError('Pattern %d is empty' % pattern_id)
+			self.unique.setdefault(pattern, []).append(pattern_id)
+		self.max_length = max(len(p) for p in self.patterns)
+
+	def scan(self, data, start = 0, end = None, report_end = None):
+		"""
+		Yields (pattern_id, offset) for every match that lies within data[start:end] and starts before report_end
+		"""
+		if end is None:
+			end = len(data)
+		if report_end is None:
+			report_end = end
+		for pattern, ids in self.unique.items():
+			pos = data.find(pattern, start, end)
+			while pos != -1 and pos < report_end:
+				for pattern_id in ids:
+					yield pattern_id, pos
+				pos = data.find(pattern, pos + 1, end)
+
+	def scan_file(self, file_handle, file_address, size, chunksize = 1024*1024):
+		"""
+		Yields (pattern_id, offset) for the size bytes at file_address, reading the file chunksize bytes at a time
+		"""
+		overlap = self.max_length - 1
+		file_handle.seek(file_address, 0)
+		tail = b''
+		base = 0
+		read = 0
+		while read < size:
+			chunk = file_handle.read(min(chunksize, size - read))
+			if not chunk:
+				return
+			read += len(chunk)
+			data = tail + chunk
+			for pattern_id, pos in self.scan(data):
+				# matches that fit in the tail were reported by the previous window
+				if pos + len(self.patterns[pattern_id]) > len(tail):
+					yield pattern_id, base + pos
+			if overlap > 0:
+				tail = data[-overlap:]
+				base += len(data) - len(tail)
+			else:
+				base += len(data)
+
+def split_ranges(segments, overlap):
+	"""
+	Turns (file_address, size, virtual_address) segments into (file_address, scan_size, report_size, virtual_address) pieces
+	"""
+	ranges = []
+	for file_address, size, virtual_address in segments:
+		for offset in range(0, size, PIECE_SIZE):
+			report_size = min(PIECE_SIZE, size - offset)
+			scan_size = min(report_size + overlap, size - offset)
+			ranges.append((file_address + offset, scan_size, report_size, virtual_address + offset))
+	return ranges
+
+def scan_ranges(filename, patterns, ranges):
+	matcher = PatternMatcher(patterns)
+	results = []
+	with open(filename, 'rb') as f:
+		with mmap.mmap(f.fileno(), 0, access = mmap.ACCESS_READ) as mm:
+			for file_address, scan_size, report_size, virtual_address in ranges:
+				for pattern_id, pos in matcher.scan(mm, file_address, file_address + scan_size, file_address + report_size):
+					results.append((pattern_id, virtual_address + pos - file_address))
+	return results
+
+def _balance(ranges, count):
+	# greedily assign the biggest ranges to the least loaded batch
+	batches = [[0, []] for _ in range(count)]
+	for r in sorted(ranges, key = lambda r: r[1], reverse = True):
+		batch = min(batches, key = lambda b: b[0])
+		batch[0] += r[1]
+		batch[1].append(r)
+	return [b[1] for b in batches if len(b[1]) > 0]
+
+def search_many(filename, file_handle, segments, patterns, workers = None):
+	"""
+	Searches all patterns in the (file_address, size, virtual_address) segments at once.
+	Returns a sorted list of (pattern_id, virtual_address) where pattern_id is the index in patterns.
+	When the dump is a file on disk it is mapped and large scans are spread over worker processes. The workers are
+	only used when they are forked (not on Windows and macOS), so the caller does not need a __main__ guard.
+	"""
+	patterns = [bytes(p) for p in patterns]
+	matcher = PatternMatcher(patterns)
+	results = []
+	if filename and os.path.isfile(filename):
+		ranges = split_ranges(segments, matcher.max_length - 1)
+		total = sum(r[1] for r in ranges)
+		if workers is None:
+			workers = os.cpu_count() or 1
+		if workers > 1 and len(ranges) > 1 and total >= PARALLEL_THRESHOLD:
+			batches = _balance(ranges, workers)
+			executor = process_pool(len(batches))
+			if executor is not None:
+				with executor:
+					futures = [executor.submit(scan_ranges, filename, patterns, batch) for batch in batches]
+					for future in futures:
+						results += future.result()
+				return sorted(results, key = lambda r: (r[1], r[0]))
+		try:
+			results = scan_ranges(filename, patterns, ranges)
+			return sorted(results, key = lambda r: (r[1], r[0]))
+		except (OSError, ValueError):
+			# empty files cannot be mapped, fall back to reading through the handle
+			results = []
+
+	pos = file_handle.tell()
+	for file_address, size, virtual_address in segments:
+		for pattern_id, offset in matcher.scan_file(file_handle, file_address, size):
+			results.append((pattern_id, virtual_address + offset))
+	file_handle.seek(pos, 0)
+	return sorted(results, key = lambda r: (r[1], r[0]))
@@ -0,0 +1,15 @@
+import multiprocessing
+from concurrent.futures import ProcessPoolExecutor
+
+def process_pool(max_workers = None, spawn = False):
+	"""
+	Returns a ProcessPoolExecutor, or None when the caller should do the work in-process. Starting the workers takes
+	longer than small jobs, so the callers only use the pool above a size threshold.
+	Workers that are not forked (spawn is the default on Windows and macOS) import the __main__ module of the caller,
+	which runs the top-level code of a script without an `if __name__ == "__main__":` guard once per worker. Those
+	are only started when spawn is set, the caller then documents that the guard is required.
+	"""
+	method = multiprocessing.get_start_method(allow_none = True) or multiprocessing.get_all_start_methods()[0]
+	if method != 'fork' and not spawn:
+		return None
+	return ProcessPoolExecutor(max_workers = max_workers)
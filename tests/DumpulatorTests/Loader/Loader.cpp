@@ -1,6 +1,48 @@
 #include "../Tests/debug.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+// Runs every Prefix_Name export and prints a tab-separated line per test:
+// RESULT\t<export>\t<PASS|FAIL>\t<microseconds>
+static int RunAllTests(HMODULE hLib)
+{
+    auto base = (char*)hLib;
+    auto dosHeader = (PIMAGE_DOS_HEADER)base;
+    auto ntHeaders = (PIMAGE_NT_HEADERS)(base + dosHeader->e_lfanew);
+    auto& exportData = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+    if (exportData.VirtualAddress == 0)
+    {
+        puts("No exports found");
+        return EXIT_FAILURE;
+    }
+    auto exportDir = (PIMAGE_EXPORT_DIRECTORY)(base + exportData.VirtualAddress);
+    auto names = (DWORD*)(base + exportDir->AddressOfNames);
+    auto ordinals = (WORD*)(base + exportDir->AddressOfNameOrdinals);
+    auto functions = (DWORD*)(base + exportDir->AddressOfFunctions);
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    auto failures = 0;
+    for (DWORD i = 0; i < exportDir->NumberOfNames; i++)
+    {
+        auto name = base + names[i];
+        // Same filter as collect_tests in run-tests.py
+        if (strchr(name, '_') == nullptr)
+            continue;
+        auto TestFunction = (int(*)())(base + functions[ordinals[i]]);
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        auto success = (TestFunction() & 0xFF) != 0;
+        QueryPerformanceCounter(&end);
+        auto microseconds = double(end.QuadPart - start.QuadPart) * 1000000.0 / double(frequency.QuadPart);
+        printf("RESULT\t%s\t%s\t%.3f\n", name, success ? "PASS" : "FAIL", microseconds);
+        fflush(stdout);
+        if (!success)
+            failures++;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int main(int argc, char** argv)
 {
@@ -15,10 +57,11 @@ int main(int argc, char** argv)
         *p_DebugPrintf = printf;
     if (argc < 2)
     {
-        // TODO: implement enumerating all exports and running them
-        puts("Usage: Loader TestFunction");
+        puts("Usage: Loader TestFunction | --all");
         return EXIT_FAILURE;
     }
+    if (strcmp(argv[1], "--all") == 0)
+        ExitProcess(RunAllTests(hLib));
     auto TestFunction = (int(*)())GetProcAddress(hLib, argv[1]);
     if (TestFunction == nullptr)
     {
@@ -0,0 +1,189 @@
+#include "debug.h"
+
+// Benchmarks for the hot paths of the emulator, the Python side reports the instruction and syscall throughput
+
+static char g_buffer[0x10000];
+
+extern "C" __declspec(dllexport) bool Bench_AluTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	// A tight loop that stays inside the same translation block
+	volatile unsigned int seed = 0x12345678;
+	unsigned int x = seed;
+	for (int i = 0; i < 1000000; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	seed = x;
+	return seed != 0;
+}
+
+extern "C" __declspec(dllexport) bool Bench_SyscallTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	wchar_t dot[] = L".";
+	UNICODE_STRING ustr{ 2, 4, dot };
+	MEMORY_BASIC_INFORMATION mbi;
+	for (int i = 0; i < 1000; i++)
+	{
+		auto status = NtDisplayString(&ustr);
+		if (!NT_SUCCESS(status))
+			return false;
+		status = NtQueryVirtualMemory(NtCurrentProcess(), (PVOID)&Bench_SyscallTest, MemoryBasicInformation, &mbi, sizeof(mbi), nullptr);
+		if (!NT_SUCCESS(status))
+		{
+			DebugPrintf("NtQueryVirtualMemory status: 0x%08X\n", status);
+			return false;
+		}
+	}
+	return true;
+}
+
+extern "C" __declspec(dllexport) bool Bench_AllocateTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	for (int i = 0; i < 2000; i++)
+	{
+		PVOID Base = 0;
+		SIZE_T RegionSize = 0x10000;
+		auto status = NtAllocateVirtualMemory(NtCurrentProcess(), &Base, 0, &RegionSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!NT_SUCCESS(status))
+		{
+			DebugPrintf("NtAllocateVirtualMemory status: 0x%08X\n", status);
+			return false;
+		}
+
+		// Touch the first and the last page
+		((char*)Base)[0] = 1;
+		((char*)Base)[RegionSize - 1] = 1;
+
+		RegionSize = 0;
+		status = NtFreeVirtualMemory(NtCurrentProcess(), &Base, &RegionSize, MEM_RELEASE);
+		if (!NT_SUCCESS(status))
+		{
+			DebugPrintf("NtFreeVirtualMemory status: 0x%08X\n", status);
+			return false;
+		}
+	}
+	return true;
+}
+
+extern "C" __declspec(dllexport) bool Bench_FileTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	HANDLE file_handle = CreateFile(
+		L"bench_file.bin",
+		GENERIC_READ | GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		DebugPrint(L"Failed to create file");
+		return false;
+	}
+
+	const int chunks = 32;
+	for (DWORD i = 0; i < sizeof(g_buffer); i++)
+		g_buffer[i] = (char)i;
+
+	bool success = true;
+	for (int i = 0; i < chunks && success; i++)
+	{
+		DWORD bytes_written = 0;
+		success = WriteFile(file_handle, g_buffer, sizeof(g_buffer), &bytes_written, NULL) && bytes_written == sizeof(g_buffer);
+	}
+
+	SetFilePointer(file_handle, 0, NULL, FILE_BEGIN);
+
+	DWORD total_read = 0;
+	while (success)
+	{
+		DWORD bytes_read = 0;
+		success = ReadFile(file_handle, g_buffer, sizeof(g_buffer), &bytes_read, NULL);
+		if (bytes_read == 0)
+			break;
+		total_read += bytes_read;
+	}
+
+	CloseHandle(file_handle);
+
+	return success && total_read == chunks * sizeof(g_buffer) && g_buffer[0x1234] == (char)0x34;
+}
+
+static volatile LONG g_vectoredCount;
+
+static LONG WINAPI BenchVectoredHandler(struct _EXCEPTION_POINTERS* ExceptionInfo)
+{
+	InterlockedIncrement(&g_vectoredCount);
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static int BenchFilter(struct _EXCEPTION_POINTERS* ExceptionInfo)
+{
+	const auto& er = *ExceptionInfo->ExceptionRecord;
+	if (er.ExceptionCode == EXCEPTION_ACCESS_VIOLATION && er.ExceptionInformation[1] == 0xDEADF00D)
+	{
+		return EXCEPTION_EXECUTE_HANDLER;
+	}
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+extern "C" __declspec(dllexport) bool Bench_ExceptionTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	// Same VEH + SEH pattern as ExceptionTest.cpp, repeated
+	const int iterations = 100;
+	g_vectoredCount = 0;
+	auto handler = AddVectoredExceptionHandler(1, BenchVectoredHandler);
+	auto caught = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		__try
+		{
+			*((volatile size_t*)(uintptr_t)0xDEADF00D) = 0;
+		}
+		__except (BenchFilter(GetExceptionInformation()))
+		{
+			caught++;
+		}
+	}
+	RemoveVectoredExceptionHandler(handler);
+	DebugPrintf("caught: %d, vectored: %d\n", caught, g_vectoredCount);
+	return caught == iterations && g_vectoredCount == iterations;
+}
+
+extern "C" __declspec(dllexport) bool Bench_AccessViolationTest()
+{
+	DebugPrint(WIDEN(__FUNCTION__));
+
+	// Exceptions as control flow without any vectored handlers, the fault is in the middle of a block
+	const int iterations = 1000;
+	auto caught = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		__try
+		{
+			auto counter = i * 3;
+			counter += *((volatile int*)(uintptr_t)0xDEADF00D);
+			caught -= counter;
+		}
+		__except (GetExceptionCode() == EXCEPTION_ACCESS_VIOLATION ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+		{
+			caught++;
+		}
+	}
+	DebugPrintf("caught: %d\n", caught);
+	return caught == iterations;
+}
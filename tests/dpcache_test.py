@@ -0,0 +1,73 @@
+import os
+import struct
+import tempfile
+import unittest
+
+import minidump.minidumpfile as minidump
+from dumpulator.dpcache import PreparedDump, PreparedRegion, PreparedThread, cache_path
+from dumpulator.modules import ModuleTable
+
+class TestPreparedDump(unittest.TestCase):
+    def setUp(self) -> None:
+        self.directory = tempfile.TemporaryDirectory()
+        self.dump = os.path.join(self.directory.name, "test.dmp")
+        with open(self.dump, "wb") as f:
+            # A CONTEXT at 0x100 with Rip = 0x140001000
+            data = bytearray(0x1000)
+            data[0:4] = b"MDMP"
+            struct.pack_into("<Q", data, 0x100 + 0xF8, 0x140001000)
+            f.write(data)
+
+    def tearDown(self) -> None:
+        self.directory.cleanup()
+
+    def prepared(self):
+        table = ModuleTable(0x1234, 0x1000, [(".text", 0x1000, 0x2345)], [(0x1000, 1, "Export", None)])
+        return PreparedDump(
+            self.dump,
+            True,
+            1337,
+            None,
+            [PreparedThread(4, 0x7ff000, None, 0x100)],
+            [PreparedRegion(0x10000, 0x3000, 0x04, 0x20000, [(0x10000, 0x1000, None), (0x11000, 0x1000, 0x02)])],
+            [(0x10000, 0x1000, 0x200)],
+            [(0x4, "File", "\\Device\\ConDrv")],
+            [[0x140000000, 0x5000, "C:\\test.exe", (0x12345678, 0x5000), table]],
+            ["ZwAccessCheck", "ZwWorkerFactoryWorkerReady"],
+            [],
+        )
+
+    def test_roundtrip(self):
+        prepared = self.prepared()
+        path = cache_path(self.dump)
+        prepared.save(path)
+        loaded = PreparedDump.load(path, self.dump)
+        context = loaded.threads[0].ContextObject
+        self.assertIsInstance(context, minidump.CONTEXT)
+        self.assertEqual(context.Rip, 0x140001000)
+        loaded.threads[0] = loaded.threads[0]._replace(ContextObject=None)
+        self.assertEqual(loaded, prepared)
+        self.assertTrue(loaded.complete)
+
+    def test_stale(self):
+        path = cache_path(self.dump)
+        self.prepared().save(path)
+        with open(self.dump, "ab") as f:
+            f.write(b"\0")
+        self.assertIsNone(PreparedDump.load(path, self.dump))
+
+    def test_invalid(self):
+        path = cache_path(self.dump)
+        self.assertIsNone(PreparedDump.load(path, self.dump))
+        with open(path, "wb") as f:
+            f.write(b"garbage")
+        self.assertIsNone(PreparedDump.load(path, self.dump))
+        # A valid header with a payload that does not have the expected layout
+        self.prepared().save(path)
+        with open(path, "r+b") as f:
+            f.seek(-8, os.SEEK_END)
+            f.write(b"[1,2,3]}")
+        self.assertIsNone(PreparedDump.load(path, self.dump))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,168 @@
+import os
+import struct
+import tempfile
+import unittest
+from types import SimpleNamespace
+from dataclasses import replace
+from typing import Dict
+
+import minidump.minidumpfile as minidump
+from dumpulator.dumpulator import Dumpulator, LazyPageManager
+from dumpulator.dumpwriter import write_minidump
+from dumpulator.dpcache import PreparedDump
+from dumpulator.handles import HandleManager, EventObject
+from dumpulator.memory import *
+from dumpulator.native import EVENT_TYPE
+
+class MockPageManager(PageManager):
+    def __init__(self):
+        self.data: Dict[int, bytearray] = {}
+
+    def commit(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        for page in range(addr, addr + size, PAGE_SIZE):
+            self.data[page] = bytearray(PAGE_SIZE)
+
+    def decommit(self, addr: int, size: int) -> None:
+        for page in range(addr, addr + size, PAGE_SIZE):
+            del self.data[page]
+
+    def protect(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        pass
+
+    def read(self, addr: int, size: int) -> bytearray:
+        assert addr & 0xFFF == 0 and size & 0xFFF == 0
+        return bytearray(b"".join(self.data[page] for page in range(addr, addr + size, PAGE_SIZE)))
+
+    def write(self, addr: int, data: bytes) -> None:
+        page, index = addr & ~0xFFF, addr & 0xFFF
+        assert index + len(data) <= PAGE_SIZE
+        self.data[page][index:index + len(data)] = data
+
+class MockRegisters:
+    # The interface used by CONTEXT.from_regs
+    def __init__(self, values):
+        self.values = values
+
+    def _resolve_reg(self, name):
+        return name
+
+    def read_batch(self, names):
+        return [self.values.get(name, 0) for name in names]
+
+    def __getitem__(self, name):
+        return self.values.get(name, 0)
+
+class TestMinidumpWriter(unittest.TestCase):
+    def setUp(self) -> None:
+        self.directory = tempfile.TemporaryDirectory()
+        # Contents of the original dump: three pages at 0x10000
+        backing = b"".join(bytes([i + 1]) * PAGE_SIZE for i in range(3))
+        pages = LazyPageManager(MockPageManager())
+        memory = MemoryManager(pages)
+        memory.reserve(0x10000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        memory.commit(0x10000, 0x4000, MemoryProtect.PAGE_READWRITE)
+        pages.backing = backing
+        pages.map_backing(0x10000, 0x3000, 0)
+        pages.lazy = False
+        # Commit the first page (unchanged) and modify the second one
+        pages.handle_lazy_page(0x10000, 1)
+        pages.write(0x11000, b"modified")
+        handles = HandleManager()
+        handles.new(EventObject(EVENT_TYPE.NotificationEvent, True))
+        current = SimpleNamespace(thread_id=4, teb=0x7ff000)
+        self.dp = SimpleNamespace(
+            x64=True,
+            process_id=1337,
+            regs=MockRegisters({"rip": 0x10000, "rsp": 0x14000, "rax": 42}),
+            scheduler=SimpleNamespace(current=current, threads={4: current}),
+            modules=[],
+            memory=memory,
+            handles=handles,
+            _pages=pages,
+            _prepared=SimpleNamespace(segments=[(0x10000, 0x3000, 0)]),
+        )
+        self.dp.read_ulong = lambda addr: struct.unpack("<I", pages.read(addr, 4))[0]
+
+    def tearDown(self) -> None:
+        self.directory.cleanup()
+
+    def write(self, incremental: bool):
+        path = os.path.join(self.directory.name, "checkpoint.dmp")
+        with open(path, "wb") as f:
+            total = write_minidump(self.dp, f, incremental)
+        return path, total
+
+    def test_full(self):
+        path, total = self.write(False)
+        # The fourth page was never touched, so it is known to be zero
+        self.assertEqual(total, 0x3000)
+        dump = minidump.MinidumpFile.parse(path)
+        self.addCleanup(dump.file_handle.close)
+        reader = dump.get_reader()
+        self.assertEqual(reader.read(0x10000, 4), b"\x01" * 4)
+        self.assertEqual(reader.read(0x11000, 8), b"modified")
+        self.assertEqual(reader.read(0x12000, 4), b"\x03" * 4)
+        self.assertEqual(dump.misc_info.ProcessId, 1337)
+        context = dump.threads.threads[0].ContextObject
+        self.assertEqual((context.Rip, context.Rsp, context.Rax), (0x10000, 0x14000, 42))
+        self.assertEqual(dump.handles.handles[0].TypeName, "Event")
+
+        prepared = PreparedDump.from_minidump(dump)
+        self.assertEqual(len(prepared.regions), 1)
+        region = prepared.regions[0]
+        self.assertEqual((region.base, region.size), (0x10000, 0x10000))
+        self.assertEqual(region.commits, [(0x10000, 0x4000, MemoryProtect.PAGE_READWRITE.value)])
+
+    def test_incremental(self):
+        path, total = self.write(True)
+        self.assertEqual(total, PAGE_SIZE)
+        dump = minidump.MinidumpFile.parse(path)
+        self.addCleanup(dump.file_handle.close)
+        segments = dump.memory_segments_64.memory_segments
+        self.assertEqual([(seg.start_virtual_address, seg.size) for seg in segments], [(0x11000, PAGE_SIZE)])
+
+    def test_overlay_released(self):
+        # Write a full dump that includes a region at 0x20000
+        self.dp.memory.reserve(0x20000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        self.dp.memory.commit(0x20000, 0x1000, MemoryProtect.PAGE_READWRITE)
+        self.dp._pages.write(0x20000, b"released")
+        base_path, _ = self.write(False)
+        base = minidump.MinidumpFile.parse(base_path)
+        self.addCleanup(base.file_handle.close)
+        # Continue from that dump with the pages mapped from the file
+        with open(base_path, "rb") as f:
+            self.dp._pages.backing = f.read()
+        self.dp._prepared = PreparedDump.from_minidump(base)
+        for virtual_address, size, file_offset in self.dp._prepared.segments:
+            self.dp._pages.map_backing(virtual_address, size, file_offset)
+        # Modify the first page and release the region at 0x20000
+        self.dp._pages.write(0x10000, b"changed")
+        self.dp.memory.release(0x20000)
+        overlay_path = os.path.join(self.directory.name, "overlay.dmp")
+        with open(overlay_path, "wb") as f:
+            write_minidump(self.dp, f, incremental=True)
+
+        # Load the overlay the way Dumpulator does it when the dump cannot be mapped
+        overlay_dump = minidump.MinidumpFile.parse(overlay_path)
+        self.addCleanup(overlay_dump.file_handle.close)
+        overlay = PreparedDump.from_minidump(overlay_dump)
+        pages = LazyPageManager(MockPageManager())
+        dp = SimpleNamespace(
+            _prepared=replace(overlay, filename=base_path, segments=self.dp._prepared.segments),
+            _overlay=overlay,
+            _minidump=base,
+            _progressive=False,
+            _map_minidump=lambda: None,
+            _pages=pages,
+            memory=MemoryManager(pages),
+            addr_mask=0xFFFFFFFFFFFFFFFF,
+            debug=lambda message: None,
+        )
+        Dumpulator._setup_memory(dp)
+        self.assertIsNone(dp.memory.find_region(0x20000))
+        self.assertEqual(pages.read(0x10000, 7), b"changed")
+        self.assertEqual(pages.read(0x11000, 8), b"modified")
+        self.assertEqual(pages.read(0x12000, 4), b"\x03" * 4)
+
+if __name__ == '__main__':
+    unittest.main()
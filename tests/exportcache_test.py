@@ -0,0 +1,52 @@
+import tempfile
+import unittest
+
+from dumpulator.exportcache import ExportCache
+from dumpulator.memory import *
+from dumpulator.modules import Module, ModuleTable, ModuleManager, ModuleSymbols
+
+class MockPageManager(PageManager):
+    def commit(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        pass
+
+    def decommit(self, addr: int, size: int) -> None:
+        pass
+
+    def protect(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        pass
+
+class TestExportCache(unittest.TestCase):
+    def test_roundtrip(self):
+        table = ModuleTable(0x1234, 0x1000, [(".text", 0x1000, 0x2345)], [
+            (0x1100, 1, "Function", None),
+            (None, 2, "Forwarded", ("kernelbase.dll", "Function")),
+            (0x1200, 3, None, None),
+        ])
+        with tempfile.TemporaryDirectory() as directory:
+            cache = ExportCache(directory)
+            assert cache.load("C:\\Windows\\System32\\test.dll", 0x5f000000, 0x10000) is None
+            cache.store("C:\\Windows\\System32\\test.dll", 0x5f000000, 0x10000, table)
+            assert cache.load("c:\\windows\\system32\\TEST.dll", 0x5f000000, 0x10000) == table
+            assert cache.load("C:\\Windows\\System32\\test.dll", 0x5f000001, 0x10000) is None
+
+        module = Module(None, "C:\\Windows\\System32\\test.dll", base=0x180000000, size=0x10000, table=table)
+        assert module.name == "test.dll"
+        # The exports are only indexed on the first lookup
+        assert module._exports is None
+        assert module.entry == 0x180001234
+        assert module.find_export("Function").address == 0x180001100
+        assert module.find_export(3).address == 0x180001200
+        assert module.find_export("Forwarded").forward == ("kernelbase.dll", "Function")
+
+        memory = MemoryManager(MockPageManager())
+        memory.reserve(0x180000000, 0x10000, MemoryProtect.PAGE_READONLY, MemoryType.MEM_IMAGE)
+        modules = ModuleManager(memory)
+        modules.add_module(module)
+        symbols = ModuleSymbols(modules)
+        assert symbols.get(0x180001100) == "test.dll:Function"
+        assert symbols.get(0x180001200) == "test.dll:#3"
+        assert symbols.get(0x180001300) is None
+        assert 0x180001100 in symbols
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,3 +1,4 @@
+import os
 import unittest
 from dumpulator.handles import *
 
@@ -69,6 +70,23 @@ class TestHandleManager(unittest.TestCase):
         with self.assertRaises(AssertionError):
             self.handles.duplicate(1)
 
+    def test_handle_reuse(self):
+        handle_1 = self.handles.new(FileObject("1"))
+        handle_2 = self.handles.new(FileObject("2"))
+        self.assertTrue(self.handles.close(handle_1))
+        # The entry is reused with the next generation, the stale value stays invalid
+        handle_3 = self.handles.new(FileObject("3"))
+        self.assertEqual(handle_3 & 0xFFFFFF, handle_1)
+        self.assertNotEqual(handle_3, handle_1)
+        self.assertFalse(self.handles.valid(handle_1))
+        self.assertIsNone(self.handles.get(handle_1, None))
+        self.assertEqual(self.handles.get(handle_3 | 2, FileObject).path, "3")
+        self.assertEqual(self.handles.get(handle_2, AbstractFileObject).path, "2")
+        stats = self.handles.statistics()
+        self.assertEqual(stats["open"], 2)
+        self.assertEqual(stats["peak"], 2)
+        self.assertEqual(stats["open_by_type"], {"FileObject": 2})
+
     def test_file_object_read(self):
         file_data = b"file_data"
         file = FileObject("file_path", file_data)
@@ -131,5 +149,44 @@ class TestHandleManager(unittest.TestCase):
         file.data = file_data
         file.file_offset = 0
 
+    def test_file_object_snapshot(self):
+        import copy
+        file = FileObject("file_path", b"file_data")
+        snapshot = copy.deepcopy(file)
+        file.write(b"test")
+        self.assertEqual(b"file_data", snapshot.data)
+        self.assertEqual(b"test_data", file.data)
+        file.file_offset = 12
+        file.write(b"!")
+        self.assertEqual(b"test_data\0\0\0!", file.data)
+
+    def test_mapped_file_object(self):
+        import copy
+        import tempfile
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "file.bin")
+            data = bytes(range(256)) * 0x200
+            with open(path, "wb") as f:
+                f.write(data)
+            file = MappedFileObject("\\??\\C:\\file.bin", path)
+            self.assertEqual(len(data), file.size)
+            file.file_offset = 0xfff0
+            self.assertEqual(data[0xfff0:0x10010], file.read(0x20))
+            snapshot = copy.deepcopy(file)
+            file.file_offset = 0xfffe
+            file.write(b"abcd")
+            file.file_offset = len(data) + 2
+            file.write(b"end")
+            self.assertEqual(len(data) + 5, file.size)
+            file.file_offset = 0xfffc
+            self.assertEqual(data[0xfffc:0xfffe] + b"abcd" + data[0x10002:0x10004], file.read(8))
+            file.file_offset = len(data) - 1
+            self.assertEqual(data[-1:] + b"\0\0end", file.read())
+            snapshot.file_offset = 0xfffe
+            self.assertEqual(data[0xfffe:0x10002], snapshot.read(4))
+            with open(path, "rb") as f:
+                self.assertEqual(data, f.read())
+            file._mapping.close()
+
 if __name__ == '__main__':
     unittest.main()
@@ -102,5 +102,82 @@ class TestMemoryManager(unittest.TestCase):
         assert info.region_size == 0x5000
         assert info.protect == MemoryProtect.PAGE_EXECUTE_READWRITE
 
+    def test_find_free(self):
+        assert self.mm.find_free(0x1000) == self.mm._minimum
+        self.mm.reserve(0x10000, 0x20000, MemoryProtect.PAGE_READWRITE)
+        self.mm.reserve(0x40000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        assert self.mm.find_free(0x10000) == 0x30000
+        assert self.mm.find_free(0x20000) == 0x50000
+        # Committing a large range only adds a single entry
+        self.mm.commit(0x10000, 0x20000, MemoryProtect.PAGE_READWRITE)
+        assert len(self.mm._committed) == 1
+        self.mm.release(0x10000)
+        assert self.mm.find_free(0x20000) == 0x10000
+        assert len(self.mm._committed) == 0
+
+    def test_find_free_first_fit(self):
+        # Gaps of 0x10000, 0x30000 and 0x20000 bytes, followed by the rest of the address space
+        self.mm.reserve(0x20000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        self.mm.reserve(0x60000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        self.mm.reserve(0x90000, 0x10000, MemoryProtect.PAGE_READWRITE)
+        assert self.mm.find_free(0x10000) == 0x10000
+        assert self.mm.find_free(0x20000) == 0x30000
+        assert self.mm.find_free(0x30000) == 0x30000
+        assert self.mm.find_free(0x40000) == 0xa0000
+        assert self.mm.find_free(0x1000, allocation_align=False) == 0x10000
+        self.mm.release(0x60000)
+        assert self.mm.find_free(0x60000) == 0x30000
+
+class TestScratchAllocator(unittest.TestCase):
+    def setUp(self) -> None:
+        self.pm = MockPageManager()
+        self.mm = MemoryManager(self.pm)
+        self.allocator = ScratchAllocator(self.mm, region_size=0x20000, commit_size=0x4000)
+
+    def test_free_list(self):
+        a = self.allocator.allocate(20)
+        b = self.allocator.allocate(20)
+        assert b - a == 0x20
+        self.allocator.free(a)
+        assert self.allocator.allocate(30) == a
+        assert self.allocator.allocate(20) != a
+        self.assertRaises(ValueError, lambda: self.allocator.free(a + 1))
+        page = self.allocator.allocate(0x10, page_align=True)
+        assert page % PAGE_SIZE == 0
+
+    def test_grow(self):
+        a = self.allocator.allocate(0x100)
+        assert a in self.pm.pages and a + 0x4000 in self.pm.pages
+        big = self.allocator.allocate(0x30000)
+        assert self.mm.query(big).region_size >= 0x30000
+        assert self.allocator.allocate(0x100) == a + 0x100
+
+    def test_reset(self):
+        a = self.allocator.allocate(0x40)
+        self.allocator.free(a)
+        mark = self.allocator.mark()
+        assert self.allocator.allocate(0x40) == a
+        b = self.allocator.allocate(0x40)
+        self.allocator.allocate(0x30000)
+        self.allocator.reset(mark)
+        assert self.allocator.allocate(0x40) == a
+        assert self.allocator.allocate(0x40) == b
+
+    def test_restore_in_scope(self):
+        outer = self.allocator.mark()
+        a = self.allocator.allocate(0x40)
+        snapshot = self.allocator.snapshot()
+        self.allocator.allocate(0x40)
+        inner = self.allocator.mark()
+        self.allocator.allocate(0x40)
+        self.allocator.restore(snapshot)
+        # The marks from before the snapshot still work, the later ones are gone
+        assert self.allocator.has_mark(outer)
+        assert not self.allocator.has_mark(inner)
+        assert self.allocator.allocate(0x40) == a + 0x40
+        self.allocator.reset(outer)
+        assert self.allocator.allocate(0x40) == a
+        self.assertRaises(AssertionError, lambda: self.allocator.reset(outer))
+
 if __name__ == "__main__":
     unittest.main()
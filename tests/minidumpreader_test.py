@@ -0,0 +1,100 @@
+import io
+import os
+import tempfile
+import unittest
+
+from minidump.common_structs import MinidumpMemorySegment, stream_search
+from minidump.minidumpreader import MinidumpBufferedReader
+from minidump import patternsearch
+
+class MockReader:
+    def __init__(self, segments, data):
+        self.memory_segments = segments
+        self.file_handle = io.BytesIO(data)
+
+def make_segment(va, rva, size):
+    ms = MinidumpMemorySegment()
+    ms.start_virtual_address = va
+    ms.size = size
+    ms.end_virtual_address = va + size
+    ms.start_file_address = rva
+    return ms
+
+class TestBufferedReader(unittest.TestCase):
+    def setUp(self) -> None:
+        self.data = os.urandom(0x10000)
+        # Segments are deliberately unsorted
+        self.segments = [
+            make_segment(0x20000, 0x8000, 0x8000),
+            make_segment(0x10000, 0x0, 0x8000),
+        ]
+        self.reader = MockReader(self.segments, self.data)
+        self.buffered = MinidumpBufferedReader(self.reader, segment_chunk_size=0x100, cache_size=0x400)
+
+    def test_read(self):
+        for address, size in [(0x100f0, 0x20), (0x10000, 0x8000), (0x27ff0, 0x10), (0x10050, 0x399)]:
+            self.buffered.move(address)
+            offset = address - 0x10000 if address < 0x20000 else address - 0x20000 + 0x8000
+            assert self.buffered.read(size) == self.data[offset:offset + size]
+            assert self.buffered.tell() == address + size
+        assert len(self.buffered.cache.chunks) <= 4
+        self.buffered.move(0x27000)
+        assert self.buffered.read() == self.data[0xf000:]
+        self.assertRaises(Exception, lambda: self.buffered.move(0x18000))
+
+    def test_readinto(self):
+        buffer = bytearray(0x1000)
+        self.buffered.move(0x20800)
+        assert self.buffered.readinto(buffer) == len(buffer)
+        assert buffer == self.data[0x8800:0x9800]
+        assert self.buffered.tell() == 0x21800
+
+    def test_find(self):
+        pattern = self.data[0x90fe:0x9104]
+        self.buffered.move(0x20000)
+        assert self.buffered.find(pattern) == 0x210fe
+        assert 0x210fe in self.buffered.find_all(pattern)
+
+class TestStreamSearch(unittest.TestCase):
+    def test_overlap(self):
+        data = b"xxabababxxab"
+        handle = io.BytesIO(data)
+        assert list(stream_search(handle, 0, len(data), b"abab", chunksize=3)) == [2, 4]
+        assert list(stream_search(handle, 2, len(data) - 2, b"ab", chunksize=1)) == [0, 2, 4, 8]
+        segment = make_segment(0x1000, 0, len(data))
+        assert segment.search(b"xxab", handle, chunksize=2) == [0x1000, 0x1008]
+        assert segment.search(b"ab", handle, find_first=True, chunksize=2) == [0x1002]
+
+class TestSearchMany(unittest.TestCase):
+    def setUp(self) -> None:
+        self.data = b"..ab.abc..xyzab" + bytes(0x20) + b"abcd"
+        self.segments = [(0, 0x10, 0x1000), (0x10, len(self.data) - 0x10, 0x5000)]
+        self.patterns = [b"abc", b"ab", b"zab", b"abcd", b"ab"]
+        self.expected = [
+            (1, 0x1002), (4, 0x1002),
+            (0, 0x1005), (1, 0x1005), (4, 0x1005),
+            (2, 0x100c), (1, 0x100d), (4, 0x100d),
+            (0, 0x501f), (1, 0x501f), (3, 0x501f), (4, 0x501f),
+        ]
+
+    def test_handle(self):
+        handle = io.BytesIO(self.data)
+        assert patternsearch.search_many(None, handle, self.segments, self.patterns) == self.expected
+
+    def test_mapped(self):
+        with tempfile.TemporaryDirectory() as directory:
+            filename = os.path.join(directory, "test.dmp")
+            with open(filename, "wb") as f:
+                f.write(self.data)
+            old_threshold, old_piece = patternsearch.PARALLEL_THRESHOLD, patternsearch.PIECE_SIZE
+            try:
+                # Force pieces that split matches and the worker pool
+                patternsearch.PARALLEL_THRESHOLD, patternsearch.PIECE_SIZE = 0, 5
+                for workers in [1, 2]:
+                    with open(filename, "rb") as handle:
+                        assert patternsearch.search_many(filename, handle, self.segments, self.patterns, workers) == self.expected
+            finally:
+                patternsearch.PARALLEL_THRESHOLD, patternsearch.PIECE_SIZE = old_threshold, old_piece
+
+if __name__ == "__main__":
+    unittest.main()
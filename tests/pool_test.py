@@ -0,0 +1,51 @@
+import unittest
+
+from dumpulator import Dumpulator
+from dumpulator.pool import DumpulatorPool
+
+class MockDumpulator(Dumpulator):
+    def __init__(self):
+        self.memory = {}
+        self.next_ptr = 0x1000
+
+    def snapshot(self):
+        return dict(self.memory), self.next_ptr
+
+    def restore(self, snapshot):
+        memory, self.next_ptr = snapshot
+        self.memory = dict(memory)
+
+    def allocate(self, size, page_align=False):
+        ptr = self.next_ptr
+        self.next_ptr += size
+        return ptr
+
+    def write(self, addr, data):
+        self.memory[addr] = bytes(data)
+
+    def call(self, addr, args=None, regs=None, count=0):
+        # "Decrypt" the first argument in place
+        self.memory[args[0]] = bytes(b ^ addr for b in self.memory[args[0]])
+        return len(self.memory[args[0]])
+
+def setup(dp):
+    dp.setup_done = True
+
+def read_output(dp, value, args):
+    return value, dp.memory[args[0]]
+
+def task(dp, item):
+    return item * 2, dp.setup_done, dp.next_ptr
+
+class TestPool(unittest.TestCase):
+    def test_map(self):
+        with DumpulatorPool(MockDumpulator(), workers=2, setup=setup) as pool:
+            blobs = [bytes([i]) * (i + 1) for i in range(20)]
+            results = pool.map(0x41, [[blob] for blob in blobs], result=read_output)
+            # Every call starts from the snapshot taken after setup
+            assert results == [(len(blob), bytes(b ^ 0x41 for b in blob)) for blob in blobs]
+            assert pool.map(task, range(5)) == [(i * 2, True, 0x1000) for i in range(5)]
+            assert list(pool.imap(0x41, [["abc"]], chunksize=1)) == [4]
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,66 @@
+import struct
+import unittest
+
+from dumpulator.ntprimitives import *
+
+class MockArchitecture(Architecture):
+    def __init__(self, x64: bool):
+        super().__init__(x64)
+        self.base = 0x10000
+        self.data = bytearray(0x3000)
+        self.reads = 0
+
+    def read(self, addr, size: int) -> bytearray:
+        addr = int(addr)
+        if addr < self.base or addr + size > self.base + len(self.data):
+            raise IndexError(f"Invalid read {hex(addr)}[{hex(size)}]")
+        self.reads += 1
+        offset = addr - self.base
+        return self.data[offset:offset + size]
+
+    def write(self, addr, data):
+        offset = int(addr) - self.base
+        self.data[offset:offset + len(data)] = data
+
+class TestPrimitives(unittest.TestCase):
+    def test_read_ptrs(self):
+        for x64 in [False, True]:
+            arch = MockArchitecture(x64)
+            for i in range(4):
+                arch.write_ptr(0x10ff8 + i * arch.ptr_size(), 0x1000 + i)
+            assert list(arch.read_ptrs(0x10ff8, 4)) == [0x1000, 0x1001, 0x1002, 0x1003]
+            assert arch.reads == 1
+
+    def test_read_many(self):
+        arch = MockArchitecture(True)
+        arch.write(0x10000, bytes(range(256)))
+        result = arch.read_many([(0x10010, 4), (0x10000, 2), (0x10ff0, 1), (0x10012, 4), (0x12000, 1)])
+        assert result[0] == bytes([0x10, 0x11, 0x12, 0x13])
+        assert result[1] == bytes([0, 1])
+        assert result[3] == bytes([0x12, 0x13, 0x14, 0x15])
+        assert len(result[4]) == 1
+        assert arch.reads == 2
+
+    def test_find_bytes(self):
+        arch = MockArchitecture(True)
+        arch.write(0x10ffe, b"needle")
+        assert arch.find_bytes(0x10000, b"needle", 0x3000) == 0x10ffe
+        assert arch.find_bytes(0x10000, b"needle", 0x1000) == -1
+        assert arch.find_bytes(0x12000, b"missing", 0x10000) == -1
+
+    def test_strlen(self):
+        arch = MockArchitecture(True)
+        arch.write(0x10ff0, b"A" * 0x20 + b"\0")
+        assert arch.strlen(0x10ff0) == 0x20
+        assert arch.strlen(0x10ff0, max_length=4) == 4
+        arch.write(0x11ff0, "test".encode("utf-16-le") + b"\0\0")
+        # The first byte is part of the string, the terminator starts at an odd offset
+        arch.write(0x11fef, b"\0")
+        assert arch.strlen(0x11ff0, 2) == 4
+        assert arch.read_str(0x11ff0, encoding="utf-16-le") == "test"
+        # Unterminated strings end at the last readable byte
+        arch.write(0x12ff0, b"B" * 0x10)
+        assert arch.strlen(0x12ff0) == 0x10
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,44 @@
+import json
+import os
+import tempfile
+import unittest
+
+from dumpulator.profiler import Profiler
+
+class TestProfiler(unittest.TestCase):
+    def test_counters(self):
+        profiler = Profiler()
+        profiler.add("emulation", "emu_start", 0.5)
+        profiler.add("syscall", "ZwClose", 0.1)
+        profiler.add("syscall", "ZwClose", 0.05)
+        profiler.add("lazy page", "commit", 0.1)
+        counter = profiler.counters["syscall"]["ZwClose"]
+        assert counter.count == 2 and counter.max == 0.1
+        summary = profiler.summary()
+        self.assertAlmostEqual(summary["hooks"], 0.25)
+        self.assertAlmostEqual(summary["cpu"], 0.25)
+        assert "ZwClose" in profiler.report()
+
+    def test_blocks(self):
+        profiler = Profiler()
+        lookups = []
+
+        def module_name(address):
+            lookups.append(address)
+            return "ntdll.dll" if address >= 0x1000 else "-"
+
+        for _ in range(3):
+            profiler.block(0x1000, module_name, lambda address: 5)
+        profiler.block(0x10, module_name, lambda address: 2)
+        assert lookups == [0x1000, 0x10]
+        assert profiler.modules["ntdll.dll"].instructions == 15
+        assert profiler.modules["ntdll.dll"].blocks == 3
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "profile.json")
+            profiler.dump(path)
+            with open(path) as f:
+                data = json.load(f)
+        assert data["modules"]["-"]["instructions"] == 2
+
+if __name__ == "__main__":
+    unittest.main()
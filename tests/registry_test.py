@@ -0,0 +1,61 @@
+import os
+import struct
+import tempfile
+import unittest
+
+from dumpulator.handles import HandleManager
+from dumpulator.native import *
+from dumpulator.registry import RegistryHive
+
+REG_FILE = r'''Windows Registry Editor Version 5.00
+
+[HKEY_LOCAL_MACHINE\SOFTWARE\Test]
+@="default"
+"Name"="C:\\Program Files\\Test"
+"Count"=dword:0000002a
+
+[HKEY_LOCAL_MACHINE\SOFTWARE\Test\Sub B]
+"Data"=hex:01,02,\
+  03,04
+
+[HKEY_LOCAL_MACHINE\SOFTWARE\Test\sub a]
+"Path"=hex(2):25,00,00,00
+
+[HKEY_CURRENT_USER\Environment]
+"TEMP"="C:\\Temp"
+'''
+
+class TestRegistry(unittest.TestCase):
+    def test_create(self):
+        hive = RegistryHive()
+        hive.create(r"\Registry\Machine\System\Test", {"Value": "data", "Number": 5})
+        key = hive.find(r"\REGISTRY\machine\system\TEST")
+        assert key.path == r"\Registry\Machine\System\Test"
+        assert key.value("value").data == "data\0".encode("utf-16-le")
+        assert key.value("NUMBER") == ("Number", REG_DWORD, struct.pack("<I", 5))
+        assert hive.find(r"\Registry\Machine\Missing") is None
+
+    def test_load_reg(self):
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "test.reg")
+            with open(path, "wb") as f:
+                f.write(b"\xff\xfe" + REG_FILE.replace("\n", "\r\n").encode("utf-16-le"))
+            handles = HandleManager()
+            handles.load_registry(path)
+            # Nothing is parsed before the registry is used
+            assert handles.registry._sources
+            handle = handles.open_file(r"\Registry\Machine\Software\test")
+            assert handle is not None
+            key = handles.get(handle, None).node
+            assert key.value("").data == "default\0".encode("utf-16-le")
+            assert key.value("name").data == "C:\\Program Files\\Test\0".encode("utf-16-le")
+            assert key.value("count").data == struct.pack("<I", 42)
+            assert [key.subkey(i).name for i in range(2)] == ["sub a", "Sub B"]
+            assert key.subkey(2) is None
+            assert key.subkey(1).value("data") == ("Data", REG_BINARY, b"\x01\x02\x03\x04")
+            assert key.subkey(0).value("path").type == REG_EXPAND_SZ
+            temp = handles.registry.find(r"\Registry\User\.DEFAULT\Environment").value("temp")
+            assert temp.data == "C:\\Temp\0".encode("utf-16-le")
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,119 @@
+import unittest
+
+from unicorn.x86_const import UC_X86_REG_RAX, UC_X86_REG_RIP
+
+from dumpulator.handles import EventObject, ThreadObject
+from dumpulator.native import EVENT_TYPE, STATUS_SUCCESS, STATUS_TIMEOUT
+from dumpulator.scheduler import GuestThread, Scheduler, ThreadState
+
+class MockContext:
+    def __init__(self, regs):
+        self.regs = dict(regs)
+
+    def reg_write(self, reg, value):
+        self.regs[reg] = value
+
+class MockUc:
+    def __init__(self):
+        self.regs = {UC_X86_REG_RAX: 0, UC_X86_REG_RIP: 0x1000}
+
+    def context_save(self):
+        return MockContext(self.regs)
+
+    def context_restore(self, context):
+        self.regs = dict(context.regs)
+
+class MockRegisters:
+    def __init__(self, uc: MockUc):
+        self._uc = uc
+
+    def __getattr__(self, name):
+        if name in ["cip", "rip"]:
+            return self._uc.regs[UC_X86_REG_RIP]
+        if name in ["cax", "rax"]:
+            return self._uc.regs[UC_X86_REG_RAX]
+        if name == "eflags":
+            return 0x202
+        raise AttributeError(name)
+
+    def __setattr__(self, name, value):
+        if name in ["cax", "rax"]:
+            self._uc.regs[UC_X86_REG_RAX] = value
+        else:
+            super().__setattr__(name, value)
+
+class MockDumpulator:
+    def __init__(self):
+        self._uc = MockUc()
+        self.regs = MockRegisters(self._uc)
+        self.x64 = True
+        self.thread_id = 0x10
+        self.teb = 0x7000
+        self.exit_code = None
+
+    def info(self, message):
+        pass
+
+    def stop(self, exit_code=None):
+        self.exit_code = exit_code
+
+class TestScheduler(unittest.TestCase):
+    def setUp(self) -> None:
+        self.dp = MockDumpulator()
+        self.scheduler = Scheduler(self.dp, self.dp.thread_id, self.dp.teb)
+        self.main = self.scheduler.current
+        self.worker = GuestThread(ThreadObject(0x2000, 0, 0x14), 0x9000, context=MockContext({UC_X86_REG_RAX: 0, UC_X86_REG_RIP: 0x2000}))
+        self.scheduler.threads[0x14] = self.worker
+
+    def test_wait_thread(self):
+        assert self.scheduler.multithreaded
+        # The main thread waits for the worker, which runs until it exits
+        exception = self.scheduler.wait([self.worker.obj], False, None)
+        assert self.scheduler.current is self.worker and self.dp.thread_id == 0x14
+        assert exception.context.regs[UC_X86_REG_RIP] == 0x2000
+        assert self.main.state == ThreadState.Waiting
+        assert self.main.context.regs[UC_X86_REG_RIP] == 0x1002
+        exception = self.scheduler.terminate(self.worker.obj, 3)
+        assert self.worker.obj.exit_status == 3
+        assert self.scheduler.current is self.main
+        # The wait returned successfully in the main thread
+        assert exception.context.regs[UC_X86_REG_RAX] == STATUS_SUCCESS
+        assert exception.context.regs[UC_X86_REG_RIP] == 0x1002
+        assert not self.scheduler.multithreaded
+        # The last thread exiting stops the emulation
+        self.scheduler.terminate(self.main.obj, 7)
+        assert self.dp.exit_code == 7
+
+    def test_event(self):
+        event = EventObject(EVENT_TYPE.SynchronizationEvent, False)
+        assert self.scheduler.wait([event], False, 0) == STATUS_TIMEOUT
+        self.scheduler.wait([event], False, None)
+        assert self.scheduler.current is self.worker
+        event.signalled = True
+        self.scheduler.signal()
+        # The synchronization event is reset by the wait it satisfied
+        assert not event.signalled
+        assert self.main.state == ThreadState.Ready
+        assert self.scheduler.preempt()
+        assert self.scheduler.current is self.main
+        assert self.dp.regs.cax == STATUS_SUCCESS
+
+    def test_timeout(self):
+        event = EventObject(EVENT_TYPE.NotificationEvent, False)
+        self.scheduler.wait([event], False, -10000)
+        # Nothing can signal the event once the worker waits as well, the timed wait expires
+        exception = self.scheduler.wait([event], True, None)
+        assert self.scheduler.current is self.main
+        assert exception.context.regs[UC_X86_REG_RAX] == STATUS_TIMEOUT
+        self.assertRaises(Exception, lambda: self.scheduler.wait([event], False, None))
+
+    def test_yield(self):
+        assert self.scheduler.yield_execution(STATUS_SUCCESS).context.regs[UC_X86_REG_RIP] == 0x2000
+        assert self.scheduler.current is self.worker
+        self.scheduler.threads[0x10].state = ThreadState.Suspended
+        assert self.scheduler.yield_execution(STATUS_SUCCESS) == STATUS_SUCCESS
+        assert self.scheduler.resume(self.main.obj)
+        assert not self.scheduler.resume(self.main.obj)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,150 @@
+import io
+import unittest
+from types import SimpleNamespace
+from typing import Dict
+
+from dumpulator.dumpulator import Dumpulator, LazyPageManager, SegmentPrefetcher
+from dumpulator.memory import *
+
+class MockPageManager(PageManager):
+    def __init__(self):
+        self.pages: Dict[int, MemoryProtect] = {}
+        self.data: Dict[int, bytearray] = {}
+
+    def commit(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        for page in range(addr, addr + size, PAGE_SIZE):
+            assert page not in self.pages
+            self.pages[page] = protect
+            self.data[page] = bytearray(PAGE_SIZE)
+
+    def decommit(self, addr: int, size: int) -> None:
+        for page in range(addr, addr + size, PAGE_SIZE):
+            del self.pages[page]
+            del self.data[page]
+
+    def protect(self, addr: int, size: int, protect: MemoryProtect) -> None:
+        for page in range(addr, addr + size, PAGE_SIZE):
+            assert page in self.pages
+            self.pages[page] = protect
+
+    def read(self, addr: int, size: int) -> bytearray:
+        page, index = addr & ~0xFFF, addr & 0xFFF
+        assert index + size <= PAGE_SIZE
+        return self.data[page][index:index + size]
+
+    def write(self, addr: int, data: bytes) -> None:
+        page, index = addr & ~0xFFF, addr & 0xFFF
+        assert index + len(data) <= PAGE_SIZE
+        self.data[page][index:index + len(data)] = data
+
+class TestSnapshot(unittest.TestCase):
+    def setUp(self) -> None:
+        self.child = MockPageManager()
+        self.pm = LazyPageManager(self.child)
+        self.pm.commit(0x10000, 0x3000, MemoryProtect.PAGE_READWRITE)
+        self.pm.handle_lazy_page(0x10000, 1)
+        self.pm.write(0x10000, b"committed")
+        self.pm.write(0x11000, b"lazy")
+
+    def test_write_protect(self):
+        self.pm.snapshot()
+        assert self.child.pages[0x10000] == MemoryProtect.PAGE_READONLY
+        assert self.pm.handle_write_fault(0x10000, 4)
+        assert self.child.pages[0x10000] == MemoryProtect.PAGE_READWRITE
+        assert not self.pm.handle_write_fault(0x10000, 4)
+
+    def test_restore(self):
+        snapshot = self.pm.snapshot()
+        for _ in range(3):
+            self.pm.write(0x10000, b"modified")
+            self.pm.write(0x11000, b"LAZY")
+            self.pm.write(0x12000, b"new")
+            self.pm.commit(0x20000, 0x1000, MemoryProtect.PAGE_READWRITE)
+            self.pm.handle_lazy_page(0x20000, 1)
+            self.pm.restore(snapshot)
+            assert self.pm.read(0x10000, 9) == b"committed"
+            assert self.pm.read(0x11000, 4) == b"lazy"
+            assert self.pm.read(0x12000, 3) == bytes(3)
+            assert 0x20000 not in self.pm.pages
+            assert 0x20000 not in self.child.pages
+            assert self.pm.total_commit == 0x3000
+
+    def test_restore_old(self):
+        snapshot = self.pm.snapshot()
+        self.pm.snapshot()
+        self.assertRaises(ValueError, lambda: self.pm.restore(snapshot))
+
+class TestBulkMemory(unittest.TestCase):
+    def setUp(self) -> None:
+        self.child = MockPageManager()
+        self.pm = LazyPageManager(self.child)
+        self.pm.commit(0x10000, 0x3000, MemoryProtect.PAGE_READWRITE)
+        self.pm.commit(0x13000, 0x1000, MemoryProtect.PAGE_READONLY)
+        self.pm.handle_lazy_page(0x10000, 1)
+
+    def test_accessible(self):
+        assert self.pm.accessible(0x10800, 0x3000)
+        assert not self.pm.accessible(0x10800, 0x3000, write=True)
+        assert self.pm.accessible(0x10800, 0x2800, write=True)
+        assert not self.pm.accessible(0x13800, 0x1000)
+
+    def test_copy(self):
+        self.pm.write(0x10ffe, b"0123456789")
+        self.pm.copy(0x11000, 0x10ffe, 10)
+        assert self.pm.read(0x10ffe, 12) == b"0101234567" + b"89"
+
+    def test_fill(self):
+        self.pm.write(0x11000, b"lazy")
+        self.pm.fill(0x10ff0, 0x2010, 0)
+        assert not self.pm.pages[0x11000].committed
+        assert self.pm.pages[0x11000].data is None
+        assert self.pm.read(0x10fe0, 0x2040) == bytes(0x2040)
+        self.pm.fill(0x10ffe, 4, 0x41)
+        assert self.pm.read(0x10ffd, 6) == b"\0AAAA\0"
+
+    def test_compare(self):
+        self.pm.write(0x10ff0, b"abcdefgh")
+        self.pm.write(0x11ff0, b"abcdXfgh")
+        assert self.pm.compare(0x10ff0, 0x11ff0, 4) == 4
+        assert self.pm.compare(0x10ff0, 0x11ff0, 8) == 4
+
+    def test_on_write(self):
+        writes = []
+        self.pm.on_write = lambda addr, size: writes.append((addr, size))
+        self.pm.write(0x10ff0, b"abcd")
+        self.pm.copy(0x11000, 0x10ff0, 4)
+        self.pm.fill(0x11000, 0x2000, 0)
+        assert writes == [(0x10ff0, 4), (0x11000, 4), (0x11000, 0x1000), (0x12000, 0x1000)]
+
+class TestPrefetch(unittest.TestCase):
+    def test_backing(self):
+        data = bytes(range(256)) * 0x100
+        child = MockPageManager()
+        pm = LazyPageManager(child)
+        pm.commit(0x10000, 0x4000, MemoryProtect.PAGE_READWRITE)
+        prefetcher = SegmentPrefetcher(io.BytesIO(data), [(0x1000, 0x4000)], keep=True)
+        pm.backing = prefetcher
+        pm.map_backing(0x10000, 0x4000, 0x1000)
+        # Accessed before the background thread fetched it
+        assert pm.read(0x10ffe, 4) == data[0x1ffe:0x2002]
+        prefetcher.start()
+        prefetcher.wait()
+        assert prefetcher.done
+        assert pm.handle_lazy_page(0x13000, 1)
+        assert child.data[0x13000] == data[0x4000:0x5000]
+
+    def test_close(self):
+        # The warm-up prefetcher owns its handle, the dump handle is closed by Dumpulator.close
+        warmup = io.BytesIO(bytes(0x10000))
+        dump_file = io.BytesIO(bytes(0x10000))
+        prefetcher = SegmentPrefetcher(warmup, [(0, 0x10000)], keep=False)
+        prefetcher.start()
+        dp = SimpleNamespace(_prefetcher=prefetcher, _pages=LazyPageManager(MockPageManager()), _dump_file=dump_file, _minidump=None)
+        Dumpulator.close(dp)
+        assert prefetcher.done and warmup.closed and dump_file.closed
+        assert dp._prefetcher is None and dp._dump_file is None
+        # Closing again does nothing
+        Dumpulator.close(dp)
+
+if __name__ == "__main__":
+    unittest.main()